@@ -13,6 +13,7 @@
 #include "log.h"
 #include "message.h"
 #include "player.h"
+#include "delta.h"
 
 
 // functions
@@ -22,6 +23,7 @@ static void initCurses();
 static bool handleMessage(void* arg, const addr_t from, const char* message);
 static bool initialGrid(const char* gridInfo);
 static bool renderMap(const char* mapString);
+static bool renderDelta(const char* message);
 static void joinGame();
 static bool leaveGame(const char* message);
 static bool handleError(const char* message);
@@ -31,6 +33,8 @@ static bool handleInput(void* arg);
 
 // static global variable, player
 static player_t* player; 
+// number of the frame on screen, when the server sends deltas
+static int shownSeq = 0;
 
 /********************* main ********************/
 int
@@ -85,7 +89,7 @@ parseArgs(const int argc, char* argv[])
   // if spectator
   if (argc == 3) {
     // spectator's player name is "spectator"
-    player = player_new("spectator", "./maps/main.txt"); // player_new must take a map file
+    player = player_new("spectator", NULL, NULL); // the server renders the map, so no vision grid
 
     return 0;
   }
@@ -98,7 +102,7 @@ parseArgs(const int argc, char* argv[])
       log_v("usage: Playername cannot be 'spectator'");
       exit(3);
     }
-    player = player_new(playername, "./maps/main.txt"); // player_new must take a map file
+    player = player_new(playername, NULL, NULL);
     return 0;
   }
 
@@ -179,6 +183,10 @@ static bool handleMessage(void* arg, const addr_t from, const char* message)
     return renderMap(remainder);
   }
 
+  if ((strcmp(first, "KEYFRAME")) == 0 || (strcmp(first, "DELTA")) == 0) {
+    return renderDelta(message);
+  }
+
   if ((strcmp(first, "ERROR")) == 0) {
     return handleError(remainder);
   }
@@ -192,6 +200,8 @@ static bool handleMessage(void* arg, const addr_t from, const char* message)
 /****************** initialGrid ******************/
 /* On reception of GRID message, start ncurses 
  * and check that display will fit grid. 
+ * Then asks the server to send the map as deltas (see delta.h);
+ * a server that can't keeps sending DISPLAY messages.
  */
 static bool initialGrid(const char* gridInfo)
 {
@@ -213,6 +223,11 @@ static bool initialGrid(const char* gridInfo)
   }
  
   log_v("Game initialized successfully."); // log successful boot up
+
+  // frames are remembered here, and only asked for if there is room
+  if (player_setDelta(player, delta_new(nrows, ncols, NULL)) != NULL) {
+    message_send(player_getAddr(player), "DELTA");
+  }
   return false;
 
 }
@@ -230,6 +245,37 @@ static bool renderMap(const char* mapString)
 
 }
 
+/********************** renderDelta ****************/
+/* applies a KEYFRAME or DELTA message to the frames received so far,
+ * acknowledges the new frame, and renders it unless a newer one is on screen;
+ * asks for a keyframe if the message can't be applied
+ */
+static bool renderDelta(const char* message)
+{
+  deltastate_t* delta = player_getDelta(player); // frames received so far
+  addr_t to = player_getAddr(player);  // address of the server
+  const char* map;                     // the new frame
+  int seq;                             // its number
+
+  if (delta == NULL) {
+    log_v("frame received without asking for deltas");
+    return false;
+  }
+  if ((seq = delta_decode(delta, message, &map)) < 0) {
+    log_v("could not apply frame, asking for a keyframe");
+    message_send(to, "DELTA");
+    return false;
+  }
+  message_sendf(to, "ACK %d", seq);
+
+  // frames may arrive out of order
+  if (seq > shownSeq) {
+    shownSeq = seq;
+    return renderMap(map);
+  }
+  return false;
+}
+
 /******************* leaveGame *******************/
 /* Close ncurses
  * Print QUIT message from server
@@ -0,0 +1,140 @@
+/*
+ * This file implements the "bitset" module for our nuggets game
+ * The "bitset" module is defined in bitset.h
+ *
+ * Winter 2022, CS50 team 1
+ */
+
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include "bitset.h"
+#include "mem.h"
+
+/**************** file-local constants *******************/
+static const int WORDBITS = 64;        // bits per word of a bitset
+
+/**************** bitset_words ****************/
+/* see header file for details */
+size_t bitset_words(size_t numBits)
+{
+  return (numBits + WORDBITS - 1) / WORDBITS;
+}
+
+/**************** bitset_new ****************/
+/* see header file for details */
+uint64_t* bitset_new(size_t numBits)
+{
+  // always allocate at least one word so an empty map still gets a bitset
+  size_t words = bitset_words(numBits);
+  return mem_calloc(words > 0 ? words : 1, sizeof(uint64_t));
+}
+
+/**************** bitset_delete ****************/
+/* see header file for details */
+void bitset_delete(uint64_t* set)
+{
+  if (set != NULL) {
+    mem_free(set);
+  }
+}
+
+/**************** bitset_clear ****************/
+/* see header file for details */
+void bitset_clear(uint64_t* set, size_t words)
+{
+  for (size_t w = 0; w < words; w++) {
+    set[w] = 0;
+  }
+}
+
+/**************** bitset_set ****************/
+/* see header file for details */
+void bitset_set(uint64_t* set, int pos)
+{
+  set[pos / WORDBITS] |= (uint64_t)1 << (pos % WORDBITS);
+}
+
+/**************** bitset_reset ****************/
+/* see header file for details */
+void bitset_reset(uint64_t* set, int pos)
+{
+  set[pos / WORDBITS] &= ~((uint64_t)1 << (pos % WORDBITS));
+}
+
+/**************** bitset_test ****************/
+/* see header file for details */
+bool bitset_test(const uint64_t* set, int pos)
+{
+  return (set[pos / WORDBITS] >> (pos % WORDBITS)) & 1;
+}
+
+/**************** bitset_setRange ****************/
+/* see header file for details */
+void bitset_setRange(uint64_t* set, int start, int len)
+{
+  int end = start + len;               // one past the last bit to set
+
+  // partial words at either end are masked, whole words in between are filled
+  while (start < end) {
+    int offset = start % WORDBITS;
+    int count = WORDBITS - offset;
+    if (count > end - start) {
+      count = end - start;
+    }
+    uint64_t mask = (count == WORDBITS) ? ~(uint64_t)0 
+                                        : (((uint64_t)1 << count) - 1) << offset;
+    set[start / WORDBITS] |= mask;
+    start += count;
+  }
+}
+
+/**************** bitset_union ****************/
+/* see header file for details */
+void bitset_union(uint64_t* dest, const uint64_t* src, size_t words)
+{
+  for (size_t w = 0; w < words; w++) {
+    dest[w] |= src[w];
+  }
+}
+
+/**************** bitset_subtract ****************/
+/* see header file for details */
+void bitset_subtract(uint64_t* dest, const uint64_t* src, size_t words)
+{
+  for (size_t w = 0; w < words; w++) {
+    dest[w] &= ~src[w];
+  }
+}
+
+/**************** bitset_intersects ****************/
+/* see header file for details */
+bool bitset_intersects(const uint64_t* a, const uint64_t* b, size_t words)
+{
+  uint64_t any = 0;                    // accumulates without branching per word
+  for (size_t w = 0; w < words; w++) {
+    any |= a[w] & b[w];
+  }
+  return any != 0;
+}
+
+/**************** bitset_next ****************/
+/* see header file for details */
+int bitset_next(const uint64_t* set, size_t words, int from)
+{
+  size_t w = from / WORDBITS;          // word containing 'from'
+
+  if (from < 0 || w >= words) {
+    return -1;
+  }
+
+  // ignore bits below 'from' in its own word
+  uint64_t bits = set[w] & (~(uint64_t)0 << (from % WORDBITS));
+  while (bits == 0) {
+    if (++w >= words) {
+      return -1;
+    }
+    bits = set[w];
+  }
+  return (int)(w * WORDBITS) + __builtin_ctzll(bits);
+}
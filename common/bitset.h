@@ -0,0 +1,74 @@
+/*
+ * This file defines the "bitset" module for our nuggets game
+ * A bitset is a packed array of 64-bit words, one bit per position in the map
+ * It is used for vision, where a set bit means a tile is visible (or was seen)
+ * Working a word at a time lets vision be merged and compared 64 tiles at once
+ *
+ * Bitsets are plain uint64_t arrays so that they can be embedded in other
+ * structures or declared on the stack; the caller tracks their length
+ *
+ * Winter 2022, CS50 team 1
+ */
+
+#ifndef __BITSET_H
+#define __BITSET_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/**************** functions **************/
+
+/**************** bitset_words ****************/
+/* returns the number of 64-bit words needed to hold the given number of bits */
+size_t bitset_words(size_t numBits);
+
+/**************** bitset_new ****************/
+/* allocates a bitset large enough to hold the given number of bits
+ * all bits are initially clear
+ * returns NULL if memory could not be allocated
+ * caller is responsible for calling bitset_delete
+ */
+uint64_t* bitset_new(size_t numBits);
+
+/**************** bitset_delete ****************/
+/* frees a bitset allocated by bitset_new, does nothing if NULL */
+void bitset_delete(uint64_t* set);
+
+/**************** bitset_clear ****************/
+/* clears every bit in the first 'words' words of the set */
+void bitset_clear(uint64_t* set, size_t words);
+
+/**************** bitset_set / bitset_reset / bitset_test ****************/
+/* set, clear, or test a single bit; the caller guarantees pos is in range */
+void bitset_set(uint64_t* set, int pos);
+void bitset_reset(uint64_t* set, int pos);
+bool bitset_test(const uint64_t* set, int pos);
+
+/**************** bitset_setRange ****************/
+/* sets 'len' consecutive bits starting at 'start' */
+void bitset_setRange(uint64_t* set, int start, int len);
+
+/**************** bitset_union ****************/
+/* dest |= src, a word at a time */
+void bitset_union(uint64_t* dest, const uint64_t* src, size_t words);
+
+/**************** bitset_subtract ****************/
+/* dest &= ~src, a word at a time
+ * leaves dest holding the bits that were set in dest but not in src
+ */
+void bitset_subtract(uint64_t* dest, const uint64_t* src, size_t words);
+
+/**************** bitset_intersects ****************/
+/* returns true if any bit is set in both a and b */
+bool bitset_intersects(const uint64_t* a, const uint64_t* b, size_t words);
+
+/**************** bitset_next ****************/
+/* returns the position of the first set bit at or after 'from'
+ * or -1 if there is none in the first 'words' words
+ * typical use:
+ *   for (int i = bitset_next(set, words, 0); i >= 0; i = bitset_next(set, words, i + 1))
+ */
+int bitset_next(const uint64_t* set, size_t words, int from);
+
+#endif
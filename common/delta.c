@@ -0,0 +1,385 @@
+/*
+ * This file implements the "delta" module for our nuggets game
+ * The "delta" module is defined in delta.h
+ *
+ * A state holds the last NUMFRAMES frames in a ring, frame 'seq' in slot
+ * seq % NUMFRAMES, all in one allocation of NUMFRAMES maps of the largest
+ * size the grid allows; the server only encodes against an acknowledged frame
+ * fewer than NUMFRAMES old, so the client, holding the frames it decoded
+ * in the same ring, always still has it
+ *
+ * Winter 2022, CS50 team 1
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include "delta.h"
+#include "mem.h"
+
+/**************** file-local constants ****************/
+static const int NUMFRAMES = 4;        // frames remembered on each side
+static const int KEYFRAMEINTERVAL = 512; // most frames between keyframes
+static const int MAXGAP = 8;           // unchanged chars a run may span
+static const int RUNHEADER = 25;       // longest "row col " and '\n' of a run
+
+/**************** local types ****************/
+typedef struct frame {
+  int seq;                             // frame number, 0 if the slot is empty
+  size_t len;                          // length of the map
+  char* map;                           // the map, capacity + 1 chars
+} frame_t;
+
+/**************** global types ****************/
+typedef struct deltastate {
+  int nrows;                           // rows in the map
+  size_t capacity;                     // longest map a frame may hold
+  frame_t* frames;                     // NUMFRAMES frames, a ring
+  int* rowStart;                       // offset of each row, used by decode
+  int nextSeq;                         // number of the next frame encoded
+  int ackedSeq;                        // newest frame the client holds, 0 if none
+  int sinceKeyframe;                   // frames encoded since the last keyframe
+  bool keyframeDue;                    // true if the next frame must be a keyframe
+  char* out;                           // the last message encoded
+  mem_arena_t* arena;                  // holds the state, NULL if malloc'd
+} deltastate_t;
+
+/**************** local functions ****************/
+static frame_t* findFrame(deltastate_t* state, int seq);
+static bool encodeDelta(deltastate_t* state, int seq, frame_t* base,
+                        const char* map, size_t len, size_t limit);
+
+/**************** delta_new ****************/
+/* see header file for details */
+deltastate_t* delta_new(int nrows, int ncols, mem_arena_t* arena)
+{
+  deltastate_t* state;                 // state to create
+  char* maps;                          // one block holding every frame's map
+
+  if (nrows <= 0 || ncols <= 0) {
+    return NULL;
+  }
+  // zeroed so delta_delete is safe on partial states
+  if ((state = mem_arena_calloc(arena, 1, sizeof(deltastate_t))) == NULL) {
+    return NULL;
+  }
+  state->arena = arena;
+  state->nrows = nrows;
+  // every row and its newline, as in the grid's active map
+  state->capacity = (size_t)nrows * (ncols + 1);
+  state->nextSeq = 1;
+  state->keyframeDue = true;
+
+  if ((state->frames = mem_arena_calloc(arena, NUMFRAMES, sizeof(frame_t))) == NULL
+      || (maps = mem_arena_alloc(arena, NUMFRAMES * (state->capacity + 1))) == NULL
+      || (state->rowStart = mem_arena_alloc(arena, (nrows + 1) * sizeof(int))) == NULL
+      || (state->out = mem_arena_alloc(arena, state->capacity + 32)) == NULL) {
+    delta_delete(state);
+    return NULL;
+  }
+  for (int i = 0; i < NUMFRAMES; i++) {
+    state->frames[i].map = maps + i * (state->capacity + 1);
+  }
+  return state;
+}
+
+/**************** delta_encode ****************/
+/* see header file for details */
+const char* delta_encode(deltastate_t* state, const char* map, size_t len)
+{
+  frame_t* last;                       // frame sent last time
+  frame_t* base = NULL;                // frame to encode against
+  frame_t* frame;                      // slot for the new frame
+  int seq;                             // number of the new frame
+
+  if (state == NULL || map == NULL || len > state->capacity) {
+    return NULL;
+  }
+  // a frame like the last needn't be sent again
+  last = findFrame(state, state->nextSeq - 1);
+  if ( ! state->keyframeDue && last != NULL && last->len == len
+       && memcmp(last->map, map, len) == 0) {
+    return NULL;
+  }
+  seq = state->nextSeq++;
+
+  // encode against the client's newest frame, unless its slot is the new one's
+  if ( ! state->keyframeDue && state->sinceKeyframe < KEYFRAMEINTERVAL
+       && state->ackedSeq > seq - NUMFRAMES) {
+    base = findFrame(state, state->ackedSeq);
+  }
+  int keyLen = snprintf(state->out, state->capacity + 32, "KEYFRAME %d\n", seq);
+  if (base != NULL && base->len == len
+      && encodeDelta(state, seq, base, map, len, keyLen + len)) {
+    state->sinceKeyframe++;
+  } else {
+    // the keyframe header is already in place
+    memcpy(state->out + keyLen, map, len);
+    state->out[keyLen + len] = '\0';
+    state->sinceKeyframe = 0;
+    state->keyframeDue = false;
+  }
+
+  // remember the frame, which the client may acknowledge
+  frame = &state->frames[seq % NUMFRAMES];
+  memcpy(frame->map, map, len);
+  frame->map[len] = '\0';
+  frame->len = len;
+  frame->seq = seq;
+  return state->out;
+}
+
+/**************** encodeDelta ****************/
+/* writes the DELTA message taking the client from frame 'base' to the map
+ * into state->out, and returns true, unless it would be 'limit' chars or more,
+ * or the rows of the two maps don't line up, when it returns false
+ * each run starts and ends on a changed char, and spans any gap of fewer
+ * than MAXGAP unchanged ones, for which sending the chars beats a new run
+ */
+static bool encodeDelta(deltastate_t* state, int seq, frame_t* base,
+                        const char* map, size_t len, size_t limit)
+{
+  char* out = state->out;              // message being written
+  const char* old = base->map;         // the client's frame
+  size_t used;                         // chars written so far
+  int row = 0;                         // row of position i
+  size_t rowStart = 0;                 // position of the start of that row
+
+  used = sprintf(out, "DELTA %d %d\n", seq, base->seq);
+  for (size_t i = 0; i < len; i++) {
+    if (map[i] == old[i]) {
+      if (map[i] == '\n') {
+        row++;
+        rowStart = i + 1;
+      }
+      continue;
+    }
+    if (map[i] == '\n' || old[i] == '\n') {
+      return false;
+    }
+    // extend the run to the last change before a long enough gap or the row's end
+    size_t end = i + 1;                // one past the run's last changed char
+    for (size_t j = end; j < len && j - end < MAXGAP
+           && map[j] != '\n' && old[j] != '\n'; j++) {
+      if (map[j] != old[j]) {
+        end = j + 1;
+      }
+    }
+    if (used + (end - i) + RUNHEADER >= limit) {
+      return false;
+    }
+    used += sprintf(out + used, "%d %zu ", row, i - rowStart);
+    memcpy(out + used, map + i, end - i);
+    used += end - i;
+    out[used++] = '\n';
+    i = end - 1;
+  }
+  out[used] = '\0';
+  return true;
+}
+
+/**************** delta_ack ****************/
+/* see header file for details */
+bool delta_ack(deltastate_t* state, int seq)
+{
+  if (state == NULL || seq >= state->nextSeq || seq <= state->ackedSeq
+      || findFrame(state, seq) == NULL) {
+    return false;
+  }
+  state->ackedSeq = seq;
+  return true;
+}
+
+/**************** delta_reset ****************/
+/* see header file for details */
+void delta_reset(deltastate_t* state)
+{
+  if (state == NULL) {
+    return;
+  }
+  // the client may have lost everything, so wait for it to acknowledge again
+  state->keyframeDue = true;
+  state->ackedSeq = 0;
+}
+
+/**************** delta_decode ****************/
+/* see header file for details */
+int delta_decode(deltastate_t* state, const char* message, const char** map)
+{
+  int seq, baseSeq;                    // numbers of the new frame and its base
+  int n = 0;                           // length of the message's first line
+  frame_t* frame;                      // slot for the new frame
+  frame_t* base;                       // frame a DELTA applies to
+
+  if (state == NULL || message == NULL || map == NULL) {
+    return -1;
+  }
+
+  if (sscanf(message, "KEYFRAME %d%n", &seq, &n) == 1 && message[n] == '\n') {
+    const char* body = message + n + 1;
+    size_t len = strlen(body);
+    if (seq <= 0 || len > state->capacity) {
+      return -1;
+    }
+    frame = &state->frames[seq % NUMFRAMES];
+    memcpy(frame->map, body, len + 1);
+    frame->len = len;
+  }
+  else if (sscanf(message, "DELTA %d %d%n", &seq, &baseSeq, &n) == 2
+           && message[n] == '\n') {
+    if ((base = findFrame(state, baseSeq)) == NULL
+        || seq <= baseSeq || seq - baseSeq >= NUMFRAMES) {
+      return -1;
+    }
+    // start from a copy of the base, in another slot
+    frame = &state->frames[seq % NUMFRAMES];
+    frame->seq = 0;
+    memcpy(frame->map, base->map, base->len + 1);
+    frame->len = base->len;
+
+    // find where each row starts
+    int numRows = 0;                   // rows found so far
+    state->rowStart[numRows++] = 0;
+    for (size_t i = 0; i < frame->len && numRows <= state->nrows; i++) {
+      if (frame->map[i] == '\n') {
+        state->rowStart[numRows++] = i + 1;
+      }
+    }
+
+    // then overwrite each run, a line of "row col chars"
+    const char* line = message + n + 1;
+    while (*line != '\0') {
+      char* rest;                      // the line after the number read
+      long row = strtol(line, &rest, 10);
+      if (rest == line || *rest != ' ' || row < 0 || row >= numRows) {
+        return -1;
+      }
+      line = rest + 1;
+      long col = strtol(line, &rest, 10);
+      const char* chars = rest + 1;
+      const char* eol = strchr(chars, '\n');
+      if (rest == line || *rest != ' ' || col < 0 || eol == NULL
+          || state->rowStart[row] + col + (eol - chars) > frame->len) {
+        return -1;
+      }
+      memcpy(frame->map + state->rowStart[row] + col, chars, eol - chars);
+      line = eol + 1;
+    }
+  }
+  else {
+    return -1;
+  }
+
+  frame->seq = seq;
+  *map = frame->map;
+  return seq;
+}
+
+/**************** delta_delete ****************/
+/* see header file for details */
+void delta_delete(deltastate_t* state)
+{
+  if (state == NULL) {
+    return;
+  }
+  // only freed here if it didn't come from an arena
+  if (state->frames != NULL) {
+    mem_arena_free(state->arena, state->frames[0].map);
+  }
+  mem_arena_free(state->arena, state->frames);
+  mem_arena_free(state->arena, state->rowStart);
+  mem_arena_free(state->arena, state->out);
+  mem_arena_free(state->arena, state);
+}
+
+/**************** findFrame ****************/
+/* returns the remembered frame numbered 'seq', or NULL if it isn't */
+static frame_t* findFrame(deltastate_t* state, int seq)
+{
+  if (seq <= 0) {
+    return NULL;
+  }
+  frame_t* frame = &state->frames[seq % NUMFRAMES];
+  return frame->seq == seq ? frame : NULL;
+}
+
+/* ********************************************************** */
+/* a simple unit test of the code above */
+#ifdef DELTATEST
+
+int main(const int argc, char* argv[])
+{
+  const int nrows = 20, ncols = 60;    // size of the test map
+  const int numFrames = 1000;          // frames sent
+  char map[nrows * (ncols + 1) + 1];   // frame being sent
+  size_t len = 0;                      // its length
+  long fullBytes = 0, sentBytes = 0;   // bytes as DISPLAY, and as sent
+  int keyframes = 0, deltas = 0, wrong = 0, lost = 0;
+
+  // a map of rows of varying length, as map files have
+  for (int r = 0; r < nrows; r++) {
+    int width = ncols - (r % 3) * 5;
+    for (int c = 0; c < width; c++) {
+      map[len++] = (r + c) % 7 == 0 ? '#' : '.';
+    }
+    map[len++] = '\n';
+  }
+  map[len] = '\0';
+
+  deltastate_t* server = delta_new(nrows, ncols, NULL);
+  deltastate_t* client = delta_new(nrows, ncols, NULL);
+  if (server == NULL || client == NULL) {
+    fprintf(stderr, "delta state creation failure\n");
+    exit(1);
+  }
+
+  srand(1);
+  for (int f = 0; f < numFrames; f++) {
+    // change a few chars, never a newline
+    for (int k = rand() % 6; k > 0; k--) {
+      size_t pos = rand() % len;
+      if (map[pos] != '\n') {
+        map[pos] = 'A' + rand() % 26;
+      }
+    }
+    const char* message = delta_encode(server, map, len);
+    if (message == NULL) {
+      continue;
+    }
+    fullBytes += strlen("DISPLAY\n") + len;
+    sentBytes += strlen(message);
+    if (strncmp(message, "KEYFRAME", 8) == 0) {
+      keyframes++;
+    } else {
+      deltas++;
+    }
+
+    // lose one message in ten, and one acknowledgement in five
+    if (rand() % 10 == 0) {
+      lost++;
+      continue;
+    }
+    const char* decoded;
+    int seq = delta_decode(client, message, &decoded);
+    if (seq < 0) {
+      delta_reset(server);
+      continue;
+    }
+    if (strcmp(decoded, map) != 0) {
+      wrong++;
+    }
+    if (rand() % 5 != 0) {
+      delta_ack(server, seq);
+    }
+  }
+
+  printf("%d keyframes, %d deltas, %d lost, %d decoded wrong\n",
+         keyframes, deltas, lost, wrong);
+  printf("%ld bytes as DISPLAY, %ld sent\n", fullBytes, sentBytes);
+  delta_delete(server);
+  delta_delete(client);
+  // every frame decoded must match the one sent
+  exit(wrong > 0 ? 1 : 0);
+}
+
+#endif
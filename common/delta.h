@@ -0,0 +1,80 @@
+/*
+ * This file defines the "delta" module for our nuggets game
+ * A deltastate remembers the last few frames (maps) sent to, or received by,
+ * one client, so that a new frame can travel as the runs of characters
+ * that changed since a frame the client is known to have
+ *
+ * The server encodes each frame against the newest frame the client has
+ * acknowledged, as one of two messages:
+ *   KEYFRAME seq\n<map>
+ *   DELTA seq base\n<row> <col> <chars>\n...
+ * where each line after the first of a DELTA replaces the characters
+ * starting at the given row and column of frame 'base' with <chars>,
+ * which run to the end of the line and may include spaces
+ * The client decodes them with the same module, and answers "ACK seq"
+ *
+ * Winter 2022, CS50 team 1
+ */
+
+#ifndef __DELTA_H
+#define __DELTA_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include "mem.h"
+
+/**************** global types ****************/
+typedef struct deltastate deltastate_t;  // opaque to users of the module
+
+/**************** functions **************/
+
+/**************** delta_new ****************/
+/* creates an empty state for frames of a map with the given number of rows
+ * and columns (see grid_getNumRows and grid_getNumColumns),
+ * allocated from the given arena, or with malloc if it is NULL
+ * the first frame encoded is always a keyframe
+ * returns NULL if either size is not positive or memory can't be allocated
+ * caller is responsible for calling delta_delete
+ */
+deltastate_t* delta_new(int nrows, int ncols, mem_arena_t* arena);
+
+/**************** delta_encode ****************/
+/* server side: remembers the given map, 'len' characters long,
+ * as the next frame, and returns the message that carries it to the client,
+ * a DELTA against the newest frame the client acknowledged, or a KEYFRAME
+ * when there is no such frame, one is due (every 512 frames,
+ * or after delta_reset), or the DELTA would be no shorter
+ * returns NULL, remembering nothing, if the map is the same as the last frame
+ * and no keyframe is due, or if it is too long for the state
+ * the message stays valid until the next call on this state
+ */
+const char* delta_encode(deltastate_t* state, const char* map, size_t len);
+
+/**************** delta_ack ****************/
+/* server side: records that the client holds frame 'seq'
+ * returns false, changing nothing, if that frame was never sent,
+ * is no newer than the last one acknowledged, or is no longer remembered
+ */
+bool delta_ack(deltastate_t* state, int seq);
+
+/**************** delta_reset ****************/
+/* server side: makes the next frame a keyframe, even if nothing changed,
+ * for a client that has lost track of its frames or just asked for them
+ */
+void delta_reset(deltastate_t* state);
+
+/**************** delta_decode ****************/
+/* client side: applies a KEYFRAME or DELTA message to the frames received
+ * so far, remembers the result, and points *map at it
+ * returns the new frame's seq, to be acknowledged,
+ * or -1 if the message is malformed or refers to a frame no longer held,
+ * in which case the client should ask for a keyframe
+ * the map stays valid until the next call on this state
+ */
+int delta_decode(deltastate_t* state, const char* message, const char** map);
+
+/**************** delta_delete ****************/
+/* frees the state, unless it came from an arena, does nothing if NULL */
+void delta_delete(deltastate_t* state);
+
+#endif
@@ -8,20 +8,47 @@
 #include <stdlib.h>
 #include <stdbool.h>
 #include <string.h>
+#include <stdint.h>
 #include "game.h"
 #include "mem.h"
 #include "grid.h"
 #include "hashtable.h"
 #include "player.h"
+#include "viscache.h"
 #include "log.h"
 
 // file-local constants (consistent with those in server)
-static const int MAXPLAYERS = 26;      // max # players in game
 static const int MAXGOLD = 250;        // max # gold in game
+static const int MINADDRSLOTS = 64;    // initial size of the address index
+static const int SUMMARYTAILBYTES = 32; // room kept in the summary to count those left out
+static const int FIRSTCHARID = 'A';    // letter of the first player to join
+static const int LASTCHARID = 'Z';     // after which letters are given out again
+static const int MAXQUEUEDKEYS = 16;   // most keys a player may have waiting
+static const int MINQUEUEDKEYS = 64;   // initial size of the key queue
+
+/**************** file-local types ****************/
+/* an entry in the address index, empty if player is NULL */
+typedef struct addrslot {
+  uint64_t key;                        // IPv4 address and port, see addrKey
+  player_t* player;                    // player at that address
+} addrslot_t;
+
+/* a key waiting in the queue for the next tick */
+typedef struct queuedkey {
+  int slot;                            // roster slot of the player who sent it
+  char key;                            // the key
+} queuedkey_t;
 
 /**************** file-local functions ****************/
-static void game_getAtAddrHelper(void* arg, const char* key, void* item);
-static void game_summaryHelper(void* arg, const char* key, void* item);
+static uint64_t addrKey(addr_t address);
+static int addrHome(game_t* game, uint64_t key);
+static int addrFind(game_t* game, uint64_t key);
+static bool addrInsert(game_t* game, uint64_t key, player_t* player);
+static void addrRemove(game_t* game, int slot);
+static bool newMapState(game_t* game, grid_t* grid);
+static void deleteMapState(game_t* game);
+static bool growRoster(game_t* game);
+static void deleteRoster(game_t* game);
 
 /*************** global types and functions ***************/
 /* that is, visible outside of this file */
@@ -30,14 +57,37 @@ static void game_summaryHelper(void* arg, const char* key, void* item);
 /* see game.h for details */
 
 typedef struct game {
-    int* piles;           // ptr to array of piles
+    int* goldAt;          // nuggets in the pile at each map position, 0 if none
+    int* pilePos;         // position of every pile left, in no order
+    int* pileSlot;        // index in pilePos of each position, -1 if no pile
+    int numPiles;         // number of gold piles left in game
     hashtable_t* players; // hashtable of player IDs
     int remainingGold;    // gold left in the game
-    int numPiles;         // number of gold piles in game
     grid_t* grid;         // current game grid
     int lastCharID;       // most recent 'player.charID'
     int numPlayers;       // number of players in a game
+    int maxPlayers;       // most players that may join, spectator aside
     char* mapfile;        // filepath of the in-game map
+    viscache_t* visionCache; // visible sets shared by all players
+    player_t** occupants; // player standing at each map position, NULL if none
+    addrslot_t* addrSlots; // open-addressing index from address to player
+    int numAddrSlots;     // size of addrSlots, a power of two
+    int numAddrs;         // addresses in the index
+    player_t** roster;    // every player, spectator included, in join order
+    int* rosterPos;       // position of each roster player
+    int* rosterGold;      // gold held by each roster player
+    char* rosterCharID;   // character representing each roster player
+    playerrole_t* rosterRole; // whether each roster player plays or watches
+    addr_t* rosterAddr;   // address of each roster player
+    int* rosterQueued;    // keys each roster player has in the key queue
+    int rosterSize;       // players in the roster
+    int maxRoster;        // room in the roster arrays
+    player_t* spectator;  // the roster's spectator, NULL if none
+    queuedkey_t* keyQueue; // keys waiting for the next tick, in arrival order
+    int queueHead;        // next key to take from keyQueue
+    int numQueued;        // keys put in keyQueue since it was last emptied
+    int maxQueued;        // room in keyQueue
+    mem_arena_t* arena;   // holds the game's memory, NULL if malloc'd
 } game_t;
 
 /**************** getters ****************/
@@ -51,13 +101,34 @@ char* game_getMapfile(game_t* game)
   return game ? game->mapfile : NULL;
 }
 
-int* game_getPiles(game_t* game)
+int game_getNumPiles(game_t* game) {
+  return game ? game->numPiles : -1;
+}
+
+int game_getPilePos(game_t* game, int index)
 {
-  return game ? game->piles : NULL;
+  if (game == NULL || index < 0 || index >= game->numPiles) {
+    return -1;
+  }
+  return game->pilePos[index];
 }
 
-int game_getNumPiles(game_t* game) {
-  return game ? game->numPiles : -1;
+int game_getGoldAt(game_t* game, int pos)
+{
+  if (game == NULL || pos < 0 || pos >= grid_getMapLen(game->grid)) {
+    return 0;
+  }
+  return game->goldAt[pos];
+}
+
+mem_arena_t* game_getArena(game_t* game)
+{
+  return game ? game->arena : NULL;
+}
+
+viscache_t* game_getVisionCache(game_t* game)
+{
+  return game ? game->visionCache : NULL;
 }
 
 hashtable_t* game_getPlayers(game_t* game) 
@@ -70,6 +141,11 @@ int game_getNumPlayers(game_t* game)
   return game ? game->numPlayers : -1;
 }
 
+int game_getMaxPlayers(game_t* game)
+{
+  return game ? game->maxPlayers : -1;
+}
+
 int game_getRemainingGold(game_t* game) 
 {
   return game ? game->remainingGold : -1;
@@ -80,6 +156,46 @@ int game_getLastCharID(game_t* game)
   return game ? game->lastCharID : -1;
 }
 
+int game_getRosterSize(game_t* game)
+{
+  return game ? game->rosterSize : 0;
+}
+
+player_t** game_getRoster(game_t* game)
+{
+  return game ? game->roster : NULL;
+}
+
+const int* game_getRosterPos(game_t* game)
+{
+  return game ? game->rosterPos : NULL;
+}
+
+const int* game_getRosterGold(game_t* game)
+{
+  return game ? game->rosterGold : NULL;
+}
+
+const char* game_getRosterCharID(game_t* game)
+{
+  return game ? game->rosterCharID : NULL;
+}
+
+const playerrole_t* game_getRosterRole(game_t* game)
+{
+  return game ? game->rosterRole : NULL;
+}
+
+const addr_t* game_getRosterAddr(game_t* game)
+{
+  return game ? game->rosterAddr : NULL;
+}
+
+player_t* game_getSpectator(game_t* game)
+{
+  return game ? game->spectator : NULL;
+}
+
 player_t* game_getPlayer(game_t* game, char* playerName)
 {
   // check params
@@ -105,15 +221,39 @@ game_setRemainingGold(game_t* game, int gold)
   }
 }
 
-/**************** game_setNumPiles ******************/
+/**************** game_addPile ******************/
 /* see header file for details */
-int game_setNumPiles(game_t* game, int numPiles)
+bool game_addPile(game_t* game, int pos, int gold)
 {
-  if (game == NULL) {
-    return -1;
+  if (game == NULL || pos < 0 || pos >= grid_getMapLen(game->grid) || gold <= 0) {
+    return false;
+  }
+  // a new pile joins the list, more gold on a pile just adds to it
+  if (game->goldAt[pos] == 0) {
+    game->pileSlot[pos] = game->numPiles;
+    game->pilePos[game->numPiles++] = pos;
   }
-  game->numPiles = numPiles;
-  return game->numPiles;
+  game->goldAt[pos] += gold;
+  return true;
+}
+
+/**************** game_takePile ******************/
+/* see header file for details */
+int game_takePile(game_t* game, int pos)
+{
+  int gold = game_getGoldAt(game, pos);  // nuggets in the pile
+
+  if (gold == 0) {
+    return 0;
+  }
+  // fill the hole in the list with the last pile
+  int slot = game->pileSlot[pos];
+  int last = game->pilePos[--game->numPiles];
+  game->pilePos[slot] = last;
+  game->pileSlot[last] = slot;
+  game->pileSlot[pos] = -1;
+  game->goldAt[pos] = 0;
+  return gold;
 }
 
 /******************* game_setGrid *******************/
@@ -124,17 +264,36 @@ game_setGrid(game_t* game, grid_t* grid)
   if ( game == NULL || grid == NULL ) {
     return false;
   } else {
+    // nobody stands on the new map yet, and it has no gold
+    grid_t* oldGrid = game->grid;
+    if ( ! newMapState(game, grid)) {
+      return false;
+    }
     // free old grid before replacing with new
-    grid_delete(game->grid);
-    game->grid = grid;
+    grid_delete(oldGrid);
+    game->mapfile = grid_getMapfile(grid);
     return true;
   }
 }
 
+/**************** game_setVisionCache ****************/
+/* see game.h for details */
+bool
+game_setVisionCache(game_t* game, viscache_t* cache)
+{
+  if ( game == NULL ) {
+    return false;
+  }
+  // free old cache before replacing with new
+  viscache_delete(game->visionCache);
+  game->visionCache = cache;
+  return true;
+}
+
 int game_setLastCharID(game_t* game, int charID)
 {
   // check params, constrains input to capital letter ASCII codes
-  if (game == NULL || charID < 65 || charID > 90) {
+  if (game == NULL || charID < FIRSTCHARID || charID > LASTCHARID) {
     return -1;
   }
 
@@ -145,7 +304,7 @@ int game_setLastCharID(game_t* game, int charID)
 
 int game_setNumPlayers(game_t* game, int numPlayers)
 {
-  if (game == NULL || numPlayers > MAXPLAYERS) {
+  if (game == NULL || numPlayers > game->maxPlayers) {
     log_d("failure to set numPlayers to %d", numPlayers);
     return -1;
   }
@@ -159,21 +318,61 @@ int game_setNumPlayers(game_t* game, int numPlayers)
 /**************** game_new ***************/
 /* see game.h or details */
 game_t* 
-game_new(int* piles, grid_t* grid)
+game_new(grid_t* grid, int maxPlayers, mem_arena_t* arena)
 {
   hashtable_t* players;         // stores players
-  const int defaultCharID = 64; // ASCII for '@', 1st player gets default + 1
+  const int defaultCharID = FIRSTCHARID - 1; // 1st player gets default + 1
+
+  // check params
+  if (grid == NULL || maxPlayers < 1) {
+    return NULL;
+  }
 
   // allocate game struct and check
-  game_t* game = malloc(sizeof(game_t));
+  game_t* game = mem_arena_alloc(arena, sizeof(game_t));
   if ( game == NULL ) { // malloc issue
     return NULL;
   }
   
-  // make hashtable and handle malloc fail
-  if ((players = hashtable_new(MAXPLAYERS)) == NULL) {
+  // make hashtable, with a slot per player so names are found in constant time,
+  // and handle malloc fail
+  if ((players = hashtable_new(maxPlayers)) == NULL) {
     // free game as, currently, it's only a pointer to a struct
-    free(game);
+    mem_arena_free(arena, game);
+    return NULL;
+  }
+
+  // nobody stands on the map yet, it has no gold, and nobody has an address
+  game->arena = arena;
+  game->grid = NULL;
+  game->occupants = NULL;
+  game->goldAt = game->pilePos = game->pileSlot = NULL;
+  game->addrSlots = mem_arena_calloc(arena, MINADDRSLOTS, sizeof(addrslot_t));
+  if (game->addrSlots == NULL || ! newMapState(game, grid)) {
+    mem_arena_free(arena, game->addrSlots);
+    hashtable_delete(players, NULL);
+    mem_arena_free(arena, game);
+    return NULL;
+  }
+  game->numAddrSlots = MINADDRSLOTS;
+  game->numAddrs = 0;
+  game->maxPlayers = maxPlayers;
+
+  // the roster starts with room for a full game and its spectator
+  game->roster = NULL;
+  game->rosterPos = game->rosterGold = NULL;
+  game->rosterCharID = NULL;
+  game->rosterRole = NULL;
+  game->rosterAddr = NULL;
+  game->rosterQueued = NULL;
+  game->rosterSize = game->maxRoster = 0;
+  game->spectator = NULL;
+  if ( ! growRoster(game)) {
+    deleteRoster(game);
+    deleteMapState(game);
+    mem_arena_free(arena, game->addrSlots);
+    hashtable_delete(players, NULL);
+    mem_arena_free(arena, game);
     return NULL;
   }
 
@@ -181,11 +380,11 @@ game_new(int* piles, grid_t* grid)
   game->players = players;
   game->numPlayers = 0;
   game->lastCharID = defaultCharID;
-  game->piles = piles;
-  game->numPiles = -1;
   game->remainingGold = MAXGOLD;
-  game->grid = grid;
   game->mapfile = grid_getMapfile(grid);
+  game->visionCache = NULL;
+  game->keyQueue = NULL;
+  game->queueHead = game->numQueued = game->maxQueued = 0;
 
   return game;
 }
@@ -195,6 +394,8 @@ game_new(int* piles, grid_t* grid)
 char* game_buildSummary(game_t* game) 
 {
   char* gameSummary;                   // summary string to return
+  size_t summaryLen;                   // length of gameSummary so far
+  int left = 0;                        // players with no room for their line
   
   // check param
   if (game == NULL) {
@@ -207,48 +408,50 @@ char* game_buildSummary(game_t* game)
     return NULL;
   }
   strcpy(gameSummary, firstLine);
+  summaryLen = strlen(gameSummary);
 
-  // pass to iterator to avoid segfault on exit
-  char** summaryPtr = &gameSummary;
-  // fill in rest of table and return
-  hashtable_iterate(game->players, summaryPtr, game_summaryHelper);
-  gameSummary = summaryPtr[0];
-  return gameSummary;
-}
-
-/*************** game_summaryHelper ***************/
-/* helper to build the summary table
- * calls player_summarize on each player
- * concatenates it to the string passed in through arg
- * also reallocates string passed through arg to store 
- * then free's the string
- */
-static void game_summaryHelper(void* arg, const char* key, void* item)
-{
-  // extract from params
-  char** gameSummary = arg;
-  char* summary = *gameSummary;
-  player_t* player = item;
-  char* temp;                              // checks realloc success           
-  
-  // ignore spectator in table
-  if (strcmp("spectator", player_getName(player)) == 0) {
-    return;
+  // add a line for everyone but the spectator, in the order they joined
+  for (int i = 0; i < game->rosterSize; i++) {
+    if (game->rosterRole[i] == ROLE_SPECTATOR) {
+      continue;
+    }
+    // in a large game the summary must still fit in one message
+    if (left > 0) {
+      left++;
+      continue;
+    }
+    char* toAdd = player_summarize(game->roster[i]); // line for this player
+    if (toAdd == NULL) {
+      continue;
+    }
+    size_t addLen = strlen(toAdd);
+    if (summaryLen + addLen > message_MaxBytes - SUMMARYTAILBYTES) {
+      free(toAdd);
+      left++;
+      continue;
+    }
+    // allocate enough memory to concat, and give up on malloc failure
+    char* temp = realloc(gameSummary, summaryLen + addLen + 1);
+    if (temp == NULL) {
+      free(toAdd);
+      return gameSummary;
+    }
+    gameSummary = temp;
+    strcpy(gameSummary + summaryLen, toAdd);
+    summaryLen += addLen;
+    free(toAdd);
   }
 
-  char* toAdd = player_summarize(player);  // string to concat to summary
-
-  // allocate enough memory to concat
-  temp = realloc(summary, (strlen(summary) + strlen(toAdd) + 1));
-  // exit on malloc failure. 
-  if (temp == NULL) {
-    return;
+  // say how many players were left out
+  if (left > 0) {
+    char* temp = realloc(gameSummary, summaryLen + SUMMARYTAILBYTES);
+    if (temp == NULL) {
+      return gameSummary;
+    }
+    gameSummary = temp;
+    snprintf(gameSummary + summaryLen, SUMMARYTAILBYTES, "...and %d more\n", left);
   }
-  summary = temp;
-  // add the player's summary to the game string, then clean up memory
-  strcat(summary, toAdd);
-  gameSummary[0] = summary;
-  free(toAdd);
+  return gameSummary;
 }
 
 /***************** game_subtractGold **************/
@@ -274,75 +477,403 @@ bool game_addPlayer(game_t* game, player_t* player)
     return false;
   }
 
+  // make room in the roster before the player can be found by name
+  if (game->rosterSize == game->maxRoster && ! growRoster(game)) {
+    return false;
+  }
+
   // get name for key and add to hashtable
   playerName = player_getName(player);
-  if (hashtable_insert(game->players, playerName, player)) {
-    // increment values for next add unless handling spectator
-    if (strcmp(player_getName(player), "spectator") != 0) {
-      game->numPlayers++;
-      game->lastCharID++;
-    }
-    return true;
+  if ( ! hashtable_insert(game->players, playerName, player)) {
+    return false;
+  }
+
+  // the spectator is the only player who gets no letter
+  int slot = game->rosterSize++;
+  if (strcmp(playerName, "spectator") == 0) {
+    game->spectator = player;
+    game->rosterRole[slot] = ROLE_SPECTATOR;
   } else {
+    // letters only draw players on the map, so past 'Z' they are shared
+    game->numPlayers++;
+    game->lastCharID = game->lastCharID < LASTCHARID ? game->lastCharID + 1 : FIRSTCHARID;
+    player_setCharID(player, (char)game->lastCharID);
+    game->rosterRole[slot] = ROLE_PLAYER;
+  }
+  player_setSlot(player, slot);
+  game->roster[slot] = player;
+  game->rosterPos[slot] = player_getPos(player);
+  game->rosterGold[slot] = player_getGold(player);
+  game->rosterCharID[slot] = player_getCharID(player);
+  game->rosterAddr[slot] = player_getAddr(player);
+  game->rosterQueued[slot] = 0;
+  return true;
+}
+
+/************** game_queueKey **************/
+/* see header file for details */
+bool game_queueKey(game_t* game, player_t* player, char key)
+{
+  int slot;                            // player's slot in the roster
+
+  // check params, and that the player still has room
+  if (game == NULL || player == NULL) {
+    return false;
+  }
+  slot = player_getSlot(player);
+  if (slot < 0 || slot >= game->rosterSize || game->roster[slot] != player
+      || game->rosterQueued[slot] >= MAXQUEUEDKEYS) {
+    return false;
+  }
+
+  // make room for another key
+  if (game->numQueued == game->maxQueued) {
+    int newMax = game->maxQueued > 0 ? 2 * game->maxQueued : MINQUEUEDKEYS;
+    void* grown = mem_arena_realloc(game->arena, game->keyQueue, 
+                                    game->maxQueued * sizeof(queuedkey_t),
+                                    newMax * sizeof(queuedkey_t));
+    if (grown == NULL) {
+      return false;
+    }
+    game->keyQueue = grown;
+    game->maxQueued = newMax;
+  }
+
+  game->keyQueue[game->numQueued].slot = slot;
+  game->keyQueue[game->numQueued].key = key;
+  game->numQueued++;
+  game->rosterQueued[slot]++;
+  return true;
+}
+
+/************** game_nextKey **************/
+/* see header file for details */
+player_t* game_nextKey(game_t* game, char* key)
+{
+  queuedkey_t* next;                   // key taken from the queue
+
+  if (game == NULL || key == NULL) {
+    return NULL;
+  }
+  // once every key is taken, the queue starts again from the front
+  if (game->queueHead == game->numQueued) {
+    game->queueHead = game->numQueued = 0;
+    return NULL;
+  }
+  next = &game->keyQueue[game->queueHead++];
+  game->rosterQueued[next->slot]--;
+  *key = next->key;
+  return game->roster[next->slot];
+}
+
+/************** game_addPlayerGold **************/
+/* see header file for details */
+int game_addPlayerGold(game_t* game, player_t* player, int gold)
+{
+  if (game == NULL || player == NULL || gold < 0) {
+    return -1;
+  }
+  int total = player_addGold(player, gold);
+  int slot = player_getSlot(player);
+  if (slot >= 0 && slot < game->rosterSize && game->roster[slot] == player) {
+    game->rosterGold[slot] = total;
+  }
+  return total;
+}
+
+/************** game_getPlayerAt ***************/
+/* see header file for details */
+player_t* game_getPlayerAt(game_t* game, int pos)
+{
+  if (game == NULL || pos < 0 || pos >= grid_getMapLen(game->grid)) {
+    return NULL;
+  }
+  return game->occupants[pos];
+}
+
+/************** game_movePlayer ***************/
+/* see header file for details */
+bool game_movePlayer(game_t* game, player_t* player, int pos)
+{
+  int mapLen;                          // length of the game's map
+  int oldPos;                          // where the player stood
+
+  if (game == NULL || player == NULL) {
+    return false;
+  }
+  mapLen = grid_getMapLen(game->grid);
+  if (pos < -1 || pos >= mapLen) {
     return false;
   }
+
+  // in a swap, the other player may already have taken the old position
+  oldPos = player_getPos(player);
+  if (oldPos >= 0 && oldPos < mapLen && game->occupants[oldPos] == player) {
+    game->occupants[oldPos] = NULL;
+  }
+  if (pos >= 0) {
+    game->occupants[pos] = player;
+  }
+  player_setPos(player, pos);
+  int slot = player_getSlot(player);
+  if (slot >= 0 && slot < game->rosterSize && game->roster[slot] == player) {
+    game->rosterPos[slot] = pos;
+  }
+  return true;
 }
 
 /************** game_getPlayerAtAddr ***************/
 /* see header file for details */
 player_t* game_getPlayerAtAddr(game_t* game, addr_t address)
 {
-  hashtable_t* players;                        // table of players in game
-  player_t* player = NULL;                     // player with given address
-  const char* addrStr = message_stringAddr(address); // string for comparision
-  void* voidplayer = NULL;              // allows pulling player from container
+  int slot;                            // index entry for the address
 
-  // copy string to avoid compiler warnings
-  char* addrStrCpy = mem_malloc_assert(strlen(addrStr) + 1, 
-                                       "failed to alloc addrstrcpy");
-  strcpy(addrStrCpy, addrStr);
-
-  // takes a name string and message string to give to hashtable_iterate
-  void* container[2] = {addrStrCpy, voidplayer};
   // check params
   if (game == NULL || ! message_isAddr(address)) {
     return NULL;
   }
+  slot = addrFind(game, addrKey(address));
+  return slot >= 0 ? game->addrSlots[slot].player : NULL;
+}
 
-  // check existence of player table and assign
-  if ((players = game_getPlayers(game)) == NULL) {
-    return NULL;
+/************** game_setPlayerAddr ***************/
+/* see header file for details */
+bool game_setPlayerAddr(game_t* game, player_t* player, addr_t address)
+{
+  int slot;                            // index entry for an address
+
+  // check params
+  if (game == NULL || player == NULL) {
+    return false;
+  }
+
+  // forget the old address, unless another player has taken it since
+  addr_t oldAddress = player_getAddr(player);
+  if (message_isAddr(oldAddress)
+      && (slot = addrFind(game, addrKey(oldAddress))) >= 0
+      && game->addrSlots[slot].player == player) {
+    addrRemove(game, slot);
   }
 
-  // iterate over hashtable, returning the player with given address if exist
-  hashtable_iterate(players, container, game_getAtAddrHelper);
-  // clean up and return
-  player = container[1];
-  log_done();
-  free(addrStrCpy);
-  return player;
+  // the latest player to use an address receives its keystrokes
+  if (message_isAddr(address)) {
+    if ((slot = addrFind(game, addrKey(address))) >= 0) {
+      game->addrSlots[slot].player = player;
+    } else if ( ! addrInsert(game, addrKey(address), player)) {
+      return false;
+    }
+  }
+  player_setAddr(player, address);
+  int rosterSlot = player_getSlot(player);
+  if (rosterSlot >= 0 && rosterSlot < game->rosterSize
+      && game->roster[rosterSlot] == player) {
+    game->rosterAddr[rosterSlot] = address;
+  }
+  return true;
 }
 
-/***************** game_getAtAddrHelper ************/
-/* helper function for game_getPlayerAtAddr
- * passed into hashtable_iterate
- * takes the target address (in string form) and a void pointer
- * that represents the player with the given address
- * inside an array of void pointers
- * updates the player pointer if there is a player matching the address
+/**************** addrKey ***************/
+/* packs the IPv4 address and port, the parts of an addr_t 
+ * that tell clients apart, into one integer
  */
-static void game_getAtAddrHelper(void* arg, const char* key, void* item) {
-  // extract params
-  void** container = arg;
-  char* targetAddrStr = container[0];
-  player_t* currPlayer = item;
-  const char* currAddrStr = message_stringAddr(player_getAddr(currPlayer));
-  
-  // compares addresses and sends matching player back to parent functions
-  if (strcmp(targetAddrStr, currAddrStr) == 0) {
-    container[1] = currPlayer;
-    return;
+static uint64_t addrKey(addr_t address)
+{
+  return ((uint64_t)address.sin_addr.s_addr << 16) | address.sin_port;
+}
+
+/**************** addrHome ***************/
+/* returns the slot where the search for key starts */
+static int addrHome(game_t* game, uint64_t key)
+{
+  // Fibonacci hashing spreads nearby addresses and ports over the index
+  return (int)((key * 0x9E3779B97F4A7C15ULL) >> 32) & (game->numAddrSlots - 1);
+}
+
+/**************** addrFind ***************/
+/* returns the slot holding key, or -1 if key is not in the index */
+static int addrFind(game_t* game, uint64_t key)
+{
+  int mask = game->numAddrSlots - 1;
+  for (int slot = addrHome(game, key); game->addrSlots[slot].player != NULL;
+       slot = (slot + 1) & mask) {
+    if (game->addrSlots[slot].key == key) {
+      return slot;
+    }
+  }
+  return -1;
+}
+
+/**************** addrInsert ***************/
+/* adds a key that is not yet in the index, 
+ * doubling the index first if it would become more than half full
+ * returns false if memory can't be allocated
+ */
+static bool addrInsert(game_t* game, uint64_t key, player_t* player)
+{
+  if (2 * (game->numAddrs + 1) > game->numAddrSlots) {
+    addrslot_t* oldSlots = game->addrSlots;
+    int oldSize = game->numAddrSlots;
+    addrslot_t* newSlots = mem_arena_calloc(game->arena, 2 * oldSize, sizeof(addrslot_t));
+    if (newSlots == NULL) {
+      return false;
+    }
+    game->addrSlots = newSlots;
+    game->numAddrSlots = 2 * oldSize;
+    game->numAddrs = 0;
+    for (int i = 0; i < oldSize; i++) {
+      if (oldSlots[i].player != NULL) {
+        addrInsert(game, oldSlots[i].key, oldSlots[i].player);
+      }
+    }
+    mem_arena_free(game->arena, oldSlots);
+  }
+
+  int mask = game->numAddrSlots - 1;
+  int slot = addrHome(game, key);
+  while (game->addrSlots[slot].player != NULL) {
+    slot = (slot + 1) & mask;
+  }
+  game->addrSlots[slot].key = key;
+  game->addrSlots[slot].player = player;
+  game->numAddrs++;
+  return true;
+}
+
+/**************** addrRemove ***************/
+/* empties the given slot, shifting back any later entries
+ * that could no longer be found with a gap before them
+ */
+static void addrRemove(game_t* game, int slot)
+{
+  int mask = game->numAddrSlots - 1;
+  int next = slot;
+
+  while (true) {
+    next = (next + 1) & mask;
+    if (game->addrSlots[next].player == NULL) {
+      break;
+    }
+    // an entry whose home is cyclically in (slot, next] stays put
+    int home = addrHome(game, game->addrSlots[next].key);
+    if (slot <= next ? (slot < home && home <= next) : (slot < home || home <= next)) {
+      continue;
+    }
+    game->addrSlots[slot] = game->addrSlots[next];
+    slot = next;
+  }
+  game->addrSlots[slot].player = NULL;
+  game->numAddrs--;
+}
+
+/**************** newMapState ***************/
+/* allocates the arrays indexed by map position for the given grid,
+ * with no players or gold on it, and makes it the game's grid
+ * frees the previous arrays, but not the previous grid
+ * returns false, leaving the game unchanged, if memory can't be allocated
+ */
+static bool newMapState(game_t* game, grid_t* grid)
+{
+  size_t mapLen = grid_getMapLen(grid);    // length of the map string
+  mem_arena_t* arena = game->arena;        // where the arrays go
+  player_t** occupants = mem_arena_calloc(arena, mapLen, sizeof(player_t*));
+  int* goldAt = mem_arena_calloc(arena, mapLen, sizeof(int));
+  int* pilePos = mem_arena_alloc(arena, mapLen * sizeof(int));
+  int* pileSlot = mem_arena_alloc(arena, mapLen * sizeof(int));
+
+  if (occupants == NULL || goldAt == NULL || pilePos == NULL || pileSlot == NULL) {
+    mem_arena_free(arena, occupants);
+    mem_arena_free(arena, goldAt);
+    mem_arena_free(arena, pilePos);
+    mem_arena_free(arena, pileSlot);
+    return false;
+  }
+  for (int pos = 0; pos < mapLen; pos++) {
+    pileSlot[pos] = -1;
   }
+
+  deleteMapState(game);
+  game->grid = grid;
+  game->occupants = occupants;
+  game->goldAt = goldAt;
+  game->pilePos = pilePos;
+  game->pileSlot = pileSlot;
+  game->numPiles = 0;
+  return true;
+}
+
+/**************** deleteMapState ***************/
+/* frees the arrays indexed by map position */
+static void deleteMapState(game_t* game)
+{
+  mem_arena_free(game->arena, game->occupants);
+  mem_arena_free(game->arena, game->goldAt);
+  mem_arena_free(game->arena, game->pilePos);
+  mem_arena_free(game->arena, game->pileSlot);
+}
+
+/**************** growRoster ***************/
+/* doubles the room in the roster arrays, or makes room for a full game
+ * and its spectator if they are empty
+ * returns false, leaving the roster as it was, if memory can't be allocated
+ */
+static bool growRoster(game_t* game)
+{
+  int oldMax = game->maxRoster;        // room in the arrays now
+  int newMax = oldMax > 0 ? 2 * oldMax : game->maxPlayers + 1;
+  mem_arena_t* arena = game->arena;    // where the arrays live
+  void* grown;                         // each array, once reallocated
+
+  // arrays that grew before a failure are just bigger than they need to be
+  if ((grown = mem_arena_realloc(arena, game->roster, oldMax * sizeof(player_t*),
+                                 newMax * sizeof(player_t*))) == NULL) {
+    return false;
+  }
+  game->roster = grown;
+  if ((grown = mem_arena_realloc(arena, game->rosterPos, oldMax * sizeof(int),
+                                 newMax * sizeof(int))) == NULL) {
+    return false;
+  }
+  game->rosterPos = grown;
+  if ((grown = mem_arena_realloc(arena, game->rosterGold, oldMax * sizeof(int),
+                                 newMax * sizeof(int))) == NULL) {
+    return false;
+  }
+  game->rosterGold = grown;
+  if ((grown = mem_arena_realloc(arena, game->rosterCharID, oldMax * sizeof(char),
+                                 newMax * sizeof(char))) == NULL) {
+    return false;
+  }
+  game->rosterCharID = grown;
+  if ((grown = mem_arena_realloc(arena, game->rosterRole, oldMax * sizeof(playerrole_t),
+                                 newMax * sizeof(playerrole_t))) == NULL) {
+    return false;
+  }
+  game->rosterRole = grown;
+  if ((grown = mem_arena_realloc(arena, game->rosterAddr, oldMax * sizeof(addr_t),
+                                 newMax * sizeof(addr_t))) == NULL) {
+    return false;
+  }
+  game->rosterAddr = grown;
+  if ((grown = mem_arena_realloc(arena, game->rosterQueued, oldMax * sizeof(int),
+                                 newMax * sizeof(int))) == NULL) {
+    return false;
+  }
+  game->rosterQueued = grown;
+  game->maxRoster = newMax;
+  return true;
+}
+
+/**************** deleteRoster ***************/
+/* frees the roster arrays, but not the players in them */
+static void deleteRoster(game_t* game)
+{
+  mem_arena_free(game->arena, game->roster);
+  mem_arena_free(game->arena, game->rosterPos);
+  mem_arena_free(game->arena, game->rosterGold);
+  mem_arena_free(game->arena, game->rosterCharID);
+  mem_arena_free(game->arena, game->rosterRole);
+  mem_arena_free(game->arena, game->rosterAddr);
+  mem_arena_free(game->arena, game->rosterQueued);
 }
 
 /******************** game_delete ******************/
@@ -351,14 +882,23 @@ void
 game_delete(game_t* game)
 {
   if ( game != NULL ) {
-    // piles is a malloc'd int array
-    free(game->piles);
-    // delete all players in game
+    // delete all players in game, then the table that found them by name
+    for (int i = 0; i < game->rosterSize; i++) {
+      player_delete(game->roster[i]);
+    }
     if (game->players != NULL) {
-      // casts player_delete to satisfy hashtable_delete
-      hashtable_delete(game->players, (void (*)(void*))player_delete);
+      hashtable_delete(game->players, NULL);
     }
+    deleteRoster(game);
     grid_delete(game->grid); // make sure not to free this memory twice
-    free(game);
+    viscache_delete(game->visionCache);
+    deleteMapState(game);
+    mem_arena_free(game->arena, game->addrSlots);
+    mem_arena_free(game->arena, game->keyQueue);
+
+    // then release everything that was allocated from the arena at once
+    mem_arena_t* arena = game->arena;
+    mem_arena_free(arena, game);
+    mem_arena_delete(arena);
   } 
 }
@@ -11,67 +11,176 @@
 #include "grid.h"
 #include "hashtable.h"
 #include "player.h"
+#include "viscache.h"
+#include "mem.h"
 
 /**************** global types ****************/
 typedef struct game game_t;  // opaque to users of the module
 
+/* what a player in the game does: play, or only watch */
+typedef enum playerrole {
+  ROLE_PLAYER,
+  ROLE_SPECTATOR
+} playerrole_t;
+
 /**************** functions **************/
 
 /**************** getters **************/
 grid_t* game_getGrid(game_t* game);
-int* game_getPiles(game_t* game);
 hashtable_t* game_getPlayers(game_t* game);
 int game_getRemainingGold(game_t* game);
 int game_getLastCharID(game_t* game);
 int game_getNumPlayers(game_t* game);
+/* the most players that may join the game, not counting the spectator */
+int game_getMaxPlayers(game_t* game);
 char* game_getMapfile(game_t* game);
+
+/* the game stores its gold piles by map position
+ * game_getNumPiles returns the number of piles left, or -1 if game is NULL
+ * game_getPilePos returns the position of the index'th pile left,
+ * for 0 <= index < game_getNumPiles(game), in no particular order, or -1
+ * game_getGoldAt returns the nuggets in the pile at pos, or 0 if there is none
+ * all take constant time
+ */
 int game_getNumPiles(game_t* game);
+int game_getPilePos(game_t* game, int index);
+int game_getGoldAt(game_t* game, int pos);
+/* the game keeps every player, the spectator included, in a roster
+ * in the order they joined, with copies of the fields read on every move
+ * in parallel arrays, so a loop over all players reads contiguous memory
+ * entry i of each array describes game_getRoster(game)[i],
+ * for 0 <= i < game_getRosterSize(game)
+ * the arrays belong to the game and may move when a player is added
+ * game_addPlayer, game_movePlayer, game_setPlayerAddr and game_addPlayerGold
+ * keep them up to date, so players in a game must only change through those
+ * the array getters return NULL if game is NULL
+ */
+int game_getRosterSize(game_t* game);
+player_t** game_getRoster(game_t* game);
+const int* game_getRosterPos(game_t* game);
+const int* game_getRosterGold(game_t* game);
+const char* game_getRosterCharID(game_t* game);
+const playerrole_t* game_getRosterRole(game_t* game);
+const addr_t* game_getRosterAddr(game_t* game);
+
+/* returns the game's spectator, or NULL if there is none */
+player_t* game_getSpectator(game_t* game);
+
+/* the arena the game allocates from, which players joining it should use too,
+ * or NULL if it uses malloc */
+mem_arena_t* game_getArena(game_t* game);
+
+/* cache of computed visible sets shared by all players, NULL if none */
+viscache_t* game_getVisionCache(game_t* game);
 
 /* finds the player in the game with the given address
+ * in constant time and without allocating, using an index kept by game_setPlayerAddr
  * returns NULL if player not found or bad parameters
  * returns player with given address if they exist
  */ 
 player_t* game_getPlayerAtAddr(game_t* game, addr_t address);
 
+/* returns the player standing at the given position of the game's map
+ * in constant time, using an array the game keeps with one entry per position
+ * returns NULL if nobody is there or bad parameters
+ */
+player_t* game_getPlayerAt(game_t* game, int pos);
+
 /**************** setters ***************/
 /* return false on failure, true on success */
 bool game_setRemainingGold(game_t* game, int gold);
 
 /* Note: the setGrid function calls grid_delete on the previous game->grid
- * to avoid memory leaks
+ * to avoid memory leaks, and forgets where players stood and gold lay on it
  */
 bool game_setGrid(game_t* game, grid_t* grid);
 
+/* Note: the setVisionCache function calls viscache_delete on the previous cache
+ * the game owns the given cache, which may be NULL to stop caching
+ * returns false if game is NULL
+ */
+bool game_setVisionCache(game_t* game, viscache_t* cache);
+
 /* returns new value, or -1 if failure.
  * integer input constrained to range of capital letter ASCII codes, [65-90]
+ * the next player to join gets the letter after it, or 'A' after 'Z'
  */
 int game_setLastCharID(game_t* game, int charID);
 
 /* sets the number of players to the given value
  * returns the new number on success
- * returns -1 when game NULL or numPlayers exceeds MAXPLAYERS
+ * returns -1 when game NULL or numPlayers exceeds game_getMaxPlayers
  * */
 int game_setNumPlayers(game_t* game, int numPlayers);
 
-/* sets the number of gold piles in a game
- * returns the new number
+/* puts gold nuggets at the given position, adding to any pile already there
+ * the map itself is left to the caller
+ * returns false if bad parameters or gold is not positive
+ */
+bool game_addPile(game_t* game, int pos, int gold);
+
+/* removes the pile at the given position in constant time
+ * returns the nuggets it held, or 0 if there was no pile there
+ */
+int game_takePile(game_t* game, int pos);
+
+/* sets the player's position, keeping game_getPlayerAt up to date
+ * pos may be -1 to take the player off the map
+ * two players swap places by moving each onto the other's old position,
+ * in either order; the map itself is left to the caller
+ * returns false if bad parameters
+ */
+bool game_movePlayer(game_t* game, player_t* player, int pos);
+
+/* sets the player's address, keeping game_getPlayerAtAddr up to date
+ * if another player already has the address, it now finds this player
+ * an address for which message_isAddr is false, such as message_noAddr(),
+ * just removes the player from the index
+ * returns false if bad parameters or the index can't grow
+ */
+bool game_setPlayerAddr(game_t* game, player_t* player, addr_t address);
+
+/* adds gold to the player's purse
+ * returns the player's new total, or -1 if bad parameters or gold is negative
+ */
+int game_addPlayerGold(game_t* game, player_t* player, int gold);
+
+/* a server that applies keys at a fixed rate keeps them in the game's key queue
+ * game_queueKey puts a key from the given player at the back of the queue
+ * in constant time; it returns false, leaving the key out, if the player already
+ * has 16 keys waiting, so a player typing fast can't make a tick arbitrarily long,
+ * or if bad parameters or the queue can't grow
+ * game_nextKey takes the key at the front of the queue, in the order they were
+ * queued, and returns the player who sent it, or NULL once the queue is empty
  */
-int game_setNumPiles(game_t* game, int numPiles);
+bool game_queueKey(game_t* game, player_t* player, char key);
+player_t* game_nextKey(game_t* game, char* key);
 
 /**************** game_new *****************/
 /* The game_new function allocates space for a new 'struct game' 
- * it only malloc's space for itself. All other memory must be allocated before
- * for example, a `game` takes non-null `grids` as parameters
+ * and for its tables of players, gold piles and addresses
+ * a `game` takes a non-null `grid` as parameter
  * so grid_new must be called on a grid before passing it to `game`
- * All memory allocated by the game, its grid, and its int array 
- * are freed in game_delete 
+ * the game starts with no players and no gold, and room for up to maxPlayers 
+ * players as well as a spectator; its tables are sized for that many,
+ * so a game of thousands of players finds them in constant time
+ * everything is allocated from the given arena (see mem.h), or with malloc if NULL,
+ * except the player hashtable, which libcs50 always mallocs;
+ * on success the game owns the arena, so the grid and players should be
+ * allocated from it too, and game_delete deletes it last
+ * All memory allocated by the game and its grid are freed in game_delete 
  */
-game_t* game_new(int* piles, grid_t* grid);
+game_t* game_new(grid_t* grid, int maxPlayers, mem_arena_t* arena);
 
 /*************** game_addPlayer **************/
 /* adds a struct player to the hashtable of players within a given game struct
  * the player is keyed by their name, which is copied into the hashtable's memory
  * thus, in the game module's memory. All "players" are free'd with game_delete 
+ * the player is also appended to the roster (see game_getRoster)
+ * a player named "spectator" becomes the game's spectator,
+ * anyone else is given the next charID, going back to 'A' after 'Z':
+ * with more than 26 players letters are shared, and only draw players on the map;
+ * a player is identified by their slot in the roster (see player_getSlot)
  * the function returns false if invalid params or if failure to add player
  * true on success
  */
@@ -80,6 +189,8 @@ bool game_addPlayer(game_t* game, player_t* player);
 /***************** game_buildSummary ***************/
 /* builds the summary table displayed to players when the game ends nomrmally
  * also includes the corresponding QUIT message
+ * stops adding players, and says how many were left out, once another line 
+ * would make it longer than one message (message_MaxBytes)
  * returns a malloc'd string, caller is responsible for free'ing it
  * returns NULL if malloc failure or game does not exist
  */
@@ -87,6 +198,8 @@ char* game_buildSummary(game_t* game);
 
 /************** game_getPlayer ***************/
 /* returns a pointer to the player struct corresponding to the given name
+ * looks the name up in a hashtable, so is meant for players joining;
+ * loop over game_getRoster to visit every player
  * returns NULL if given string or game invalid, or if player not in hashtable
  */
 player_t* game_getPlayer(game_t* game, char* playerName);
@@ -100,10 +213,13 @@ int game_subtractGold(game_t* game, int gold);
 
 /************** game_delete ****************/
 /* free's all memory assosciated with a `game` 
- * sets the int array of gold piles to NULL
- * calls hashtable_delete on the table of players
+ * frees its gold piles and the other arrays indexed by map position
+ * calls player_delete on every player in the roster
+ * and hashtable_delete on the table of players
  * calls grid_delete on the grid
- * then free's the game itself
+ * calls viscache_delete on the vision cache
+ * then free's the game itself, and deletes its arena, if it has one,
+ * releasing everything allocated from it in one call
  */
 void game_delete(game_t* game);
 
@@ -12,28 +12,84 @@
 #include <string.h>
 #include <stdbool.h>
 #include <ctype.h>
+#include <limits.h>
+#include <pthread.h>
 #include "grid.h"
+#include "bitset.h"
 #include "mem.h"
 #include "file.h"
 
 /**************** file-local constants *******************/
 const char ROOMTILE = '.';
+static const char PASSAGETILE = '#';
+static const char SOLIDTILE = ' ';      // border and padding of the tile array
+static const int TILEALIGN = 64;        // tile rows start on a cache line
+static const char DISPLAYHEAD[] = "DISPLAY\n"; // written in front of the active map
 /**************** file-local global variables ****************/
 /* none */
 
 /**************** local types ****************/
-/* none */
+/* a connected area of room or passage tiles, see labelRegions */
+typedef struct region {
+  char tile;                           // ROOMTILE or PASSAGETILE
+  int minX, minY;                      // top left corner of bounding box
+  int maxX, maxY;                      // bottom right corner, inclusive
+} region_t;
+
+/* a visibility table, see grid_buildVisibility */
+typedef struct vistable {
+  int* offsets;                        // per-tile offset of its first run in runs
+  int* runs;                           // (start, length) runs of visible positions
+} vistable_t;
+
+/* the read-only part of a grid, shared by every grid made from the same map */
+typedef struct layer {
+  char* block;                         // one aligned allocation holding the tiles,
+                                       // region and conversion arrays and reference map
+  int refs;                            // grids using the layer, guarded by imagesLock
+  vistable_t vis[VISION_SHADOWCAST + 1]; // table for each vision mode, once built,
+                                       // guarded by imagesLock
+} layer_t;
 
 /**************** global types ****************/
 typedef struct grid {
-  char* reference;                     // original map file read into a string
-  char* active;                        // map string that changes during game
+  char* reference;                     // original map file read into a string, shared
+  char* active;                        // map string that changes during game, private
+  char* display;                       // DISPLAYHEAD then the active map, one allocation
   size_t mapLen;                       // length of map string
   int numColumns;                      // number of rows in the map
   int numRows;                         // number of columns in the map
   char* mapfile;                       // filepath of in-game grid
+  visionmode_t visionMode;             // algorithm used by calculateVision
+  int* visOffsets;                     // per-tile offset of its first run in visRuns,
+  int* visRuns;                        // (start, length) runs of visible positions,
+                                       // both in the layer's table for visionMode
+  uint64_t* dirty;                     // active positions changed since last clear
+  char* tiles;                         // reference map as rows of tileStride tiles,
+                                       // surrounded by one solid tile on every side
+  int tileStride;                      // tiles per row, a multiple of TILEALIGN
+  int tileRows;                        // rows of the map, not counting the border
+  int* cellOf;                         // index into tiles of each map position
+  int* posOf;                          // map position of each tile, -1 if none
+  int* regionOf;                       // region of each tile, -1 if none
+  region_t* regions;                   // every room and passage region
+  int numRegions;                      // number of regions
+  layer_t* layer;                      // holds reference, tiles and the region and 
+                                       // conversion arrays; NULL while loading
+  int* emptyTiles;                     // position of every ROOMTILE in active, unordered;
+                                       // NULL until first needed, see indexEmptyTiles
+  int* emptySlot;                      // index in emptyTiles of each position, -1 if none
+  int numEmpty;                        // number of positions in emptyTiles
+  mem_arena_t* arena;                  // holds the grid's own parts, NULL if malloc'd
 } grid_t;
 
+/**************** file-local global variables ****************/
+/* every map parsed so far, keyed by mapfile; grid_new clones these */
+static grid_t** images = NULL;
+static int numImages = 0;
+static int maxImages = 0;
+static pthread_mutex_t imagesLock = PTHREAD_MUTEX_INITIALIZER;
+
 /**************** global functions ****************/
 /* that is, visible outside this file */
 /* see grid.h for comments about exported functions */
@@ -43,10 +99,29 @@ typedef struct grid {
 static int longestRowLength(char* map);
 static void posToCoordinates(grid_t* grid, int pos, int* tuple);
 static int coordinatesToPos(grid_t* grid, int x, int y);
+static bool isTransparent(grid_t* grid, int x, int y);
+static void raycastVision(grid_t* grid, int pos, uint64_t* vision);
+static void shadowcastVision(grid_t* grid, int pos, uint64_t* vision);
+static void freeVisibility(grid_t* grid);
+static bool buildVisTable(grid_t* grid, vistable_t* table);
+static void deleteLayer(layer_t* layer);
+static bool buildTiles(grid_t* grid);
+static bool labelRegions(grid_t* grid);
+static grid_t* loadImage(char* mapFile);
+static grid_t* findImage(char* mapFile);
+static bool addImage(grid_t* image);
+static bool packImage(grid_t* grid);
+static grid_t* cloneImage(grid_t* image, mem_arena_t* arena);
+static bool indexEmptyTiles(grid_t* grid);
+static void setActive(grid_t* grid, int pos, char newChar);
+static bool lineOfSight(grid_t* grid, int fromCell, int toCell);
+static void visionBounds(grid_t* grid, int pos, int* box);
+static void castLight(grid_t* grid, uint64_t* vision, int px, int py, int row,
+                      double start, double end, const int* octant);
 
 /**************** getters *****************/
 /* returns NULL or 0 if values don't exist as appropriate */
-char* grid_getReference(grid_t* grid)
+const char* grid_getReference(grid_t* grid)
 {
   return grid ? grid->reference : NULL;
 }
@@ -61,6 +136,11 @@ char* grid_getActive(grid_t* grid)
   return grid ? grid->active : NULL;
 }
 
+const char* grid_getDisplay(grid_t* grid)
+{
+  return grid ? grid->display : NULL;
+}
+
 int grid_getNumRows(grid_t* grid)
 {
   return grid ? grid->numRows : 0;
@@ -76,80 +156,134 @@ size_t grid_getMapLen(grid_t* grid)
   return grid ? grid->mapLen : 0;
 }
 
+size_t grid_getVisionWords(grid_t* grid)
+{
+  return grid ? bitset_words(grid->mapLen) : 0;
+}
+
+int grid_getNumRegions(grid_t* grid)
+{
+  return grid ? grid->numRegions : 0;
+}
+
+int grid_getRegion(grid_t* grid, int pos)
+{
+  if (grid == NULL || grid->regionOf == NULL || pos < 0 || pos >= grid->mapLen) {
+    return -1;
+  }
+  return grid->regionOf[grid->cellOf[pos]];
+}
+
+visionmode_t grid_getVisionMode(grid_t* grid)
+{
+  return grid ? grid->visionMode : VISION_RAYCAST;
+}
+
+/**************** setters *****************/
+/* see grid.h for details */
+bool grid_setVisionMode(grid_t* grid, visionmode_t mode)
+{
+  if (grid == NULL || (mode != VISION_RAYCAST && mode != VISION_SHADOWCAST)) {
+    return false;
+  }
+  if (grid->visionMode != mode) {
+    // a table built by the other engine no longer matches calculateVision
+    freeVisibility(grid);
+  }
+  grid->visionMode = mode;
+  return true;
+}
+
 /**************** grid_new *****************/
 /* see header file for details */
-grid_t* grid_new(char* mapFile)
+grid_t* grid_new(char* mapFile, mem_arena_t* arena)
 {
-  FILE* fp = NULL;                     // file to read from
+  grid_t* image;                       // parsed map to share
+  grid_t* unlisted = NULL;             // parsed map that couldn't be listed
   grid_t* grid = NULL;                 // grid struct to create
-  
-  // allocate space for grid, return NULL if failure
-  if ((grid = mem_malloc(sizeof(grid_t))) == NULL) {
+
+  if (mapFile == NULL) {
     return NULL;
   }
 
-  // open file and read into struct
-  if ((fp = fopen(mapFile, "r")) != NULL) {
-    // number of rows in the grid == number of lines in source file
-    grid->numRows = file_numLines(fp);
-    // allocate reference by reading from file
-    grid->reference = file_readFile(fp);
-    fclose(fp);
-    // clean up and return NULL if failure to allocate reference map
-    if (grid->reference == NULL) {
-      grid_delete(grid);
-      return NULL;
-    }
-    // store length of map string
-    grid->mapLen = strlen(grid->reference);
-
-    // create a copy of the reference map to use as active map
-    grid->active = mem_malloc(strlen(grid->reference) + 1);
-    // clean up and return NULL if failure to allocate active map
-    if (grid->active == NULL) {
-      grid_delete(grid);
-      return NULL;
+  pthread_mutex_lock(&imagesLock);
+  if ((image = findImage(mapFile)) == NULL && (image = loadImage(mapFile)) != NULL) {
+    if ( ! addImage(image)) {
+      unlisted = image;
+      image = NULL;
     }
+  }
+  if (image != NULL) {
+    grid = cloneImage(image, arena);
+  }
+  pthread_mutex_unlock(&imagesLock);
 
-    // copy map into new memory
-    strcpy(grid->active, grid->reference);
-
-    // number of colums == length of longest row
-    grid->numColumns = longestRowLength(grid->reference);
-    
-    // copy mapfile into memory
-    grid->mapfile = mem_malloc_assert(strlen(mapFile) + 1, 
-                                      "failed to alloc mapfile in grid\n");
-    strcpy(grid->mapfile, mapFile);
+  // grid_delete takes the lock to release the image's layer
+  grid_delete(unlisted);
+  return grid;
+}
 
-    // return the "complete" grid only if all operations successful
-    return grid;
+/**************** grid_clearMapCache *****************/
+/* see header file for details */
+void grid_clearMapCache(void)
+{
+  grid_t** list;                       // images to delete
+  int count;                           // number of images
+
+  // empty the list, then delete the images without holding the lock
+  pthread_mutex_lock(&imagesLock);
+  list = images;
+  count = numImages;
+  images = NULL;
+  numImages = maxImages = 0;
+  pthread_mutex_unlock(&imagesLock);
+
+  for (int i = 0; i < count; i++) {
+    grid_delete(list[i]);
+  }
+  if (list != NULL) {
+    mem_free(list);
+  }
+}
 
-  } else {
-    // clean up and return NULL if file unreadable
-    mem_free(grid);
-    return NULL;
+/**************** grid_neighbor **************/
+/* see header file for details */
+int grid_neighbor(grid_t* grid, int pos, int dx, int dy)
+{
+  if (grid == NULL || grid->tiles == NULL || pos < 0 || pos >= grid->mapLen
+      || dx < -1 || dx > 1 || dy < -1 || dy > 1) {
+    return -1;
   }
+  // every position has a tile on each side, even at the edge of the map
+  return grid->posOf[grid->cellOf[pos] + dy * grid->tileStride + dx];
 }
 
 /*********** grid_containsEmptyTile **********/
 /* see header file for details */
 bool grid_containsEmptyTile(grid_t* grid)
+{
+  return grid_getNumEmptyTiles(grid) > 0;
+}
+
+/*********** grid_getNumEmptyTiles **********/
+/* see header file for details */
+int grid_getNumEmptyTiles(grid_t* grid)
 {
   // check params and active map
-  if (grid == NULL || grid->active == NULL) {
-    return false;
+  if (grid == NULL || grid->active == NULL || ! indexEmptyTiles(grid)) {
+    return 0;
   }
+  return grid->numEmpty;
+}
 
-  // loop over all tiles
-  for (int i = 0; i < grid->mapLen; i++) {
-    if (grid->active[i] == ROOMTILE) {
-      return true;
-    }
+/*********** grid_getEmptyTile **********/
+/* see header file for details */
+int grid_getEmptyTile(grid_t* grid, int index)
+{
+  if (index < 0 || index >= grid_getNumEmptyTiles(grid)) {
+    return -1;
   }
-
-  // false if no empty tile
-  return false;
+  return grid->emptyTiles[index];
 }
 
 /**************** grid_replace ***************/
@@ -166,7 +300,7 @@ bool grid_replace(grid_t* grid, int pos, char newChar)
   }
 
   // set character at given pos to given character and return success
-  grid->active[pos] = newChar;
+  setActive(grid, pos, newChar);
   return true;
 }
 
@@ -184,29 +318,85 @@ bool grid_revertTile(grid_t* grid, int pos)
   }
 
   // set 'active' character at given pos to reference value and return
-  grid->active[pos] = grid->reference[pos];
+  setActive(grid, pos, grid->reference[pos]);
+  return true;
+}
+
+/**************** grid_markDirty ***************/
+/* see header file for details */
+bool grid_markDirty(grid_t* grid, int pos)
+{
+  if (grid == NULL || grid->dirty == NULL || pos < 0 || pos > grid->mapLen - 1) {
+    return false;
+  }
+  bitset_set(grid->dirty, pos);
   return true;
 }
 
+/**************** grid_getDirty ***************/
+/* see header file for details */
+const uint64_t* grid_getDirty(grid_t* grid)
+{
+  return grid ? grid->dirty : NULL;
+}
+
+/**************** grid_clearDirty ***************/
+/* see header file for details */
+void grid_clearDirty(grid_t* grid)
+{
+  if (grid != NULL && grid->dirty != NULL) {
+    bitset_clear(grid->dirty, bitset_words(grid->mapLen));
+  }
+}
+
 /**************** grid_delete ***************/
 /* see header file for details */
 void grid_delete(grid_t* grid)
 {
-  // free strings if they exist
-  if (grid->active != NULL) {
-    mem_free(grid->active);
-  }
+  bool lastUser = false;               // true if no other grid shares the layer
 
-  if (grid->reference != NULL) {
-    mem_free(grid->reference);
+  if (grid == NULL) {
+    return;
   }
 
-  if (grid->mapfile != NULL) {
-    mem_free(grid->mapfile);
+  if (grid->layer != NULL) {
+    // the reference map, tiles and region arrays belong to the shared layer
+    pthread_mutex_lock(&imagesLock);
+    lastUser = --grid->layer->refs == 0;
+    pthread_mutex_unlock(&imagesLock);
+    if (lastUser) {
+      deleteLayer(grid->layer);
+    }
+  } else {
+    // a grid that failed to load still has them allocated separately
+    if (grid->reference != NULL) {
+      mem_free(grid->reference);
+    }
+    free(grid->tiles);
+    if (grid->cellOf != NULL) {
+      mem_free(grid->cellOf);
+    }
+    if (grid->posOf != NULL) {
+      mem_free(grid->posOf);
+    }
+    if (grid->regionOf != NULL) {
+      mem_free(grid->regionOf);
+    }
+    if (grid->regions != NULL) {
+      mem_free(grid->regions);
+    }
   }
 
+  // the grid's own parts are only freed here if they didn't come from an arena
+  freeVisibility(grid);
+  mem_arena_free(grid->arena, grid->display);
+  mem_arena_free(grid->arena, grid->mapfile);
+  mem_arena_free(grid->arena, grid->dirty);
+  mem_arena_free(grid->arena, grid->emptyTiles);
+  mem_arena_free(grid->arena, grid->emptySlot);
+
   // then free the struct itself
-  mem_free(grid);
+  mem_arena_free(grid->arena, grid);
 }
 
 /************* findLongestRow **************/
@@ -242,6 +432,398 @@ static int longestRowLength(char* map)
   return rowMax;
 }
 
+/**************** loadImage ****************/
+/* reads and parses the given map file into a grid for grid_new to share,
+ * with its read-only parts packed into a layer, and no active map or dirty bitset
+ * returns NULL if the file can't be read or memory can't be allocated
+ */
+static grid_t* loadImage(char* mapFile)
+{
+  FILE* fp = NULL;                     // file to read from
+  grid_t* grid = NULL;                 // grid struct to create
+  
+  // allocate space for grid, zeroed so grid_delete is safe on partial grids
+  if ((grid = mem_calloc(1, sizeof(grid_t))) == NULL) {
+    return NULL;
+  }
+
+  // open file and read into struct
+  if ((fp = fopen(mapFile, "r")) != NULL) {
+    // number of rows in the grid == number of lines in source file
+    grid->numRows = file_numLines(fp);
+    // allocate reference by reading from file
+    grid->reference = file_readFile(fp);
+    fclose(fp);
+    // clean up and return NULL if failure to allocate reference map
+    if (grid->reference == NULL) {
+      grid_delete(grid);
+      return NULL;
+    }
+    // store length of map string
+    grid->mapLen = strlen(grid->reference);
+
+    // number of colums == length of longest row
+    grid->numColumns = longestRowLength(grid->reference);
+
+    // lay the map out as tiles, then find the rooms and passages, 
+    // which bound what can be seen from each tile
+    // and pack it all into one layer that every grid of this map can share
+    // (grid_delete doesn't lock imagesLock until the layer exists)
+    if ( ! buildTiles(grid) || ! labelRegions(grid) || ! packImage(grid)) {
+      grid_delete(grid);
+      return NULL;
+    }
+    
+    // copy mapfile into memory, it is the image's key
+    grid->mapfile = mem_malloc_assert(strlen(mapFile) + 1, 
+                                      "failed to alloc mapfile in grid\n");
+    strcpy(grid->mapfile, mapFile);
+
+    // return the "complete" grid only if all operations successful
+    return grid;
+
+  } else {
+    // clean up and return NULL if file unreadable
+    mem_free(grid);
+    return NULL;
+  }
+}
+
+/**************** findImage ****************/
+/* returns the image already loaded from the given mapfile, or NULL
+ * the caller must hold imagesLock
+ */
+static grid_t* findImage(char* mapFile)
+{
+  for (int i = 0; i < numImages; i++) {
+    if (strcmp(images[i]->mapfile, mapFile) == 0) {
+      return images[i];
+    }
+  }
+  return NULL;
+}
+
+/**************** addImage ****************/
+/* adds a loaded image to the list searched by findImage
+ * the caller must hold imagesLock
+ * returns false if memory can't be allocated
+ */
+static bool addImage(grid_t* image)
+{
+  grid_t** temp;                       // checks realloc success
+
+  if (numImages == maxImages) {
+    int newMax = maxImages == 0 ? 4 : maxImages * 2;
+    if ((temp = realloc(images, newMax * sizeof(grid_t*))) == NULL) {
+      return false;
+    }
+    images = temp;
+    maxImages = newMax;
+  }
+  images[numImages++] = image;
+  return true;
+}
+
+/**************** packImage ****************/
+/* moves the tile, conversion and region arrays and the reference map
+ * of a freshly parsed grid into one block, each part starting on a
+ * TILEALIGN boundary, frees the separate allocations,
+ * and makes the block a layer used only by this grid so far
+ * returns false if memory can't be allocated
+ */
+static bool packImage(grid_t* grid)
+{
+  size_t numTiles = (size_t)grid->tileStride * (grid->tileRows + 2);
+  layer_t* layer;                      // layer to create
+  struct {
+    void** field;                      // pointer in grid to move into the block
+    size_t size;                       // bytes it points to
+    size_t offset;                     // where it goes in the block
+  } parts[] = {
+    { (void**)&grid->tiles, numTiles, 0 },
+    { (void**)&grid->cellOf, (grid->mapLen + 1) * sizeof(int), 0 },
+    { (void**)&grid->posOf, numTiles * sizeof(int), 0 },
+    { (void**)&grid->regionOf, numTiles * sizeof(int), 0 },
+    { (void**)&grid->regions, grid->numRegions * sizeof(region_t), 0 },
+    { (void**)&grid->reference, grid->mapLen + 1, 0 },
+  };
+  int numParts = sizeof(parts) / sizeof(parts[0]);
+
+  // lay the parts out one after another, rounding each up to TILEALIGN
+  size_t size = 0;
+  for (int i = 0; i < numParts; i++) {
+    parts[i].offset = size;
+    size += (parts[i].size + TILEALIGN - 1) / TILEALIGN * TILEALIGN;
+  }
+  if ((layer = mem_malloc(sizeof(layer_t))) == NULL) {
+    return false;
+  }
+  if ((layer->block = aligned_alloc(TILEALIGN, size)) == NULL) {
+    mem_free(layer);
+    return false;
+  }
+  layer->refs = 1;
+  memset(layer->vis, 0, sizeof(layer->vis));
+
+  for (int i = 0; i < numParts; i++) {
+    memcpy(layer->block + parts[i].offset, *parts[i].field, parts[i].size);
+    // tiles came from aligned_alloc, the rest from mem_malloc or realloc
+    if (i == 0) {
+      free(*parts[i].field);
+    } else {
+      mem_free(*parts[i].field);
+    }
+    *parts[i].field = layer->block + parts[i].offset;
+  }
+  grid->layer = layer;
+  return true;
+}
+
+/**************** cloneImage ****************/
+/* makes a new grid sharing a loaded image's layer
+ * the new grid gets its own active map, copied from the reference map
+ * just after a DISPLAY header,
+ * its own mapfile, an empty dirty bitset, raycast vision and no visibility table
+ * all allocated from the given arena, or with malloc if it is NULL
+ * the caller must hold imagesLock
+ * returns NULL if memory can't be allocated
+ */
+static grid_t* cloneImage(grid_t* image, mem_arena_t* arena)
+{
+  grid_t* grid;                        // grid struct to create
+  size_t words = bitset_words(image->mapLen); // length of the dirty bitset
+
+  // zeroed so grid_delete is safe on partial grids
+  if ((grid = mem_arena_calloc(arena, 1, sizeof(grid_t))) == NULL) {
+    return NULL;
+  }
+  grid->arena = arena;
+  // the private parts first, so a partial grid has no layer to release
+  size_t headLen = strlen(DISPLAYHEAD);
+  if ((grid->display = mem_arena_alloc(arena, headLen + image->mapLen + 1)) == NULL
+      || (grid->mapfile = mem_arena_alloc(arena, strlen(image->mapfile) + 1)) == NULL
+      || (grid->dirty = mem_arena_calloc(arena, words > 0 ? words : 1, 
+                                         sizeof(uint64_t))) == NULL) { // nothing changed yet
+    grid_delete(grid);
+    return NULL;
+  }
+  memcpy(grid->display, DISPLAYHEAD, headLen);
+  grid->active = grid->display + headLen;
+  memcpy(grid->active, image->reference, image->mapLen + 1);
+  strcpy(grid->mapfile, image->mapfile);
+
+  grid->mapLen = image->mapLen;
+  grid->numColumns = image->numColumns;
+  grid->numRows = image->numRows;
+  // the original ray walk remains the default vision algorithm
+  grid->visionMode = VISION_RAYCAST;
+
+  // share everything else
+  grid->reference = image->reference;
+  grid->tiles = image->tiles;
+  grid->tileStride = image->tileStride;
+  grid->tileRows = image->tileRows;
+  grid->cellOf = image->cellOf;
+  grid->posOf = image->posOf;
+  grid->regionOf = image->regionOf;
+  grid->regions = image->regions;
+  grid->numRegions = image->numRegions;
+  grid->layer = image->layer;
+  grid->layer->refs++;
+  return grid;
+}
+
+/**************** indexEmptyTiles ****************/
+/* builds the index of empty room tiles in the active map, if not built yet
+ * from then on setActive keeps it up to date
+ * returns false if memory can't be allocated
+ */
+static bool indexEmptyTiles(grid_t* grid)
+{
+  if (grid->emptySlot != NULL) {
+    return true;
+  }
+  if ((grid->emptyTiles = mem_arena_alloc(grid->arena, grid->mapLen * sizeof(int))) == NULL
+      || (grid->emptySlot = mem_arena_alloc(grid->arena, grid->mapLen * sizeof(int))) == NULL) {
+    mem_arena_free(grid->arena, grid->emptyTiles);
+    grid->emptyTiles = NULL;
+    return false;
+  }
+  grid->numEmpty = 0;
+  for (int pos = 0; pos < grid->mapLen; pos++) {
+    if (grid->active[pos] == ROOMTILE) {
+      grid->emptySlot[pos] = grid->numEmpty;
+      grid->emptyTiles[grid->numEmpty++] = pos;
+    } else {
+      grid->emptySlot[pos] = -1;
+    }
+  }
+  return true;
+}
+
+/**************** setActive ****************/
+/* changes the active map at a valid position, marking it dirty
+ * and moving it into or out of the index of empty tiles, if there is one
+ */
+static void setActive(grid_t* grid, int pos, char newChar)
+{
+  char oldChar = grid->active[pos];    // character being replaced
+
+  if (oldChar == newChar) {
+    return;
+  }
+  grid->active[pos] = newChar;
+  bitset_set(grid->dirty, pos);
+
+  if (grid->emptySlot == NULL) {
+    return;
+  }
+  if (oldChar == ROOMTILE) {
+    // fill the hole with the last empty tile
+    int slot = grid->emptySlot[pos];
+    int last = grid->emptyTiles[--grid->numEmpty];
+    grid->emptyTiles[slot] = last;
+    grid->emptySlot[last] = slot;
+    grid->emptySlot[pos] = -1;
+  } else if (newChar == ROOMTILE) {
+    grid->emptySlot[pos] = grid->numEmpty;
+    grid->emptyTiles[grid->numEmpty++] = pos;
+  }
+}
+
+/**************** buildTiles ****************/
+/* copies the reference map into the padded tile array
+ * row y of the map starts at tile (y + 1) * tileStride + 1, and every tile
+ * not holding a map character is SOLIDTILE, so each map tile has neighbors
+ * on all sides and rows of different lengths line up as they are displayed
+ * also fills in cellOf and posOf to convert between positions and tiles;
+ * a newline maps to the tile just past the end of its row
+ * returns false if memory can't be allocated
+ */
+static bool buildTiles(grid_t* grid)
+{
+  int x = 0;                           // column of the current position
+  int y = 0;                           // row of the current position
+  size_t numTiles;                     // tiles in the padded array
+
+  // rows are ended by newlines, except perhaps the last
+  grid->tileRows = 0;
+  for (int pos = 0; pos < grid->mapLen; pos++) {
+    if (grid->reference[pos] == '\n' || pos == grid->mapLen - 1) {
+      grid->tileRows++;
+    }
+  }
+  grid->tileStride = (grid->numColumns + 2 + TILEALIGN - 1) / TILEALIGN * TILEALIGN;
+  numTiles = (size_t)grid->tileStride * (grid->tileRows + 2);
+
+  if ((grid->tiles = aligned_alloc(TILEALIGN, numTiles)) == NULL
+      || (grid->cellOf = mem_malloc((grid->mapLen + 1) * sizeof(int))) == NULL
+      || (grid->posOf = mem_malloc(numTiles * sizeof(int))) == NULL) {
+    return false;
+  }
+  memset(grid->tiles, SOLIDTILE, numTiles);
+  for (int cell = 0; cell < numTiles; cell++) {
+    grid->posOf[cell] = -1;
+  }
+
+  for (int pos = 0; pos < grid->mapLen; pos++) {
+    int cell = (y + 1) * grid->tileStride + x + 1;
+    grid->cellOf[pos] = cell;
+    if (grid->reference[pos] == '\n') {
+      y++;
+      x = 0;
+    } else {
+      grid->tiles[cell] = grid->reference[pos];
+      grid->posOf[cell] = pos;
+      x++;
+    }
+  }
+  return true;
+}
+
+/* offsets to the neighbors of a tile: the eight around it, then knight's moves */
+static const int neighbors[16][2] = {
+  {-1, -1}, {0, -1}, {1, -1}, {-1, 0}, {1, 0}, {-1, 1}, {0, 1}, {1, 1},
+  {-2, -1}, {-1, -2}, {1, -2}, {2, -1}, {-2, 1}, {-1, 2}, {1, 2}, {2, 1}
+};
+
+/**************** labelRegions ****************/
+/* splits the map into regions: areas of room tiles, or of passage
+ * tiles, connected horizontally, vertically or diagonally
+ * room tiles a knight's move apart are connected too, because a line of sight
+ * passing between two tiles can step from one to the other (see visionBounds)
+ * fills in regionOf for every tile and a bounding box for every region
+ * returns false if memory can't be allocated
+ */
+static bool labelRegions(grid_t* grid)
+{
+  int* stack;                          // tiles waiting to be flood filled
+  int maxRegions = 16;                 // capacity of grid->regions
+  region_t* temp;                      // checks realloc success
+  int numTiles = grid->tileStride * (grid->tileRows + 2);
+
+  if ((grid->regionOf = mem_malloc(numTiles * sizeof(int))) == NULL
+      || (grid->regions = mem_malloc(maxRegions * sizeof(region_t))) == NULL
+      || (stack = mem_malloc(numTiles * sizeof(int))) == NULL) {
+    return false;
+  }
+  for (int cell = 0; cell < numTiles; cell++) {
+    grid->regionOf[cell] = -1;
+  }
+
+  // visit tiles in map order, so regions are numbered top to bottom
+  for (int pos = 0; pos < grid->mapLen; pos++) {
+    int cell = grid->cellOf[pos];
+    char tile = grid->tiles[cell];
+    if (grid->regionOf[cell] >= 0 || (tile != ROOMTILE && tile != PASSAGETILE)) {
+      continue;
+    }
+
+    // start a new region here
+    if (grid->numRegions == maxRegions) {
+      maxRegions *= 2;
+      if ((temp = realloc(grid->regions, maxRegions * sizeof(region_t))) == NULL) {
+        mem_free(stack);
+        return false;
+      }
+      grid->regions = temp;
+    }
+    int id = grid->numRegions++;
+    region_t* region = &grid->regions[id];
+    region->tile = tile;
+    region->minX = region->minY = INT_MAX;
+    region->maxX = region->maxY = INT_MIN;
+
+    // flood fill the region, growing its bounding box
+    int top = 0;
+    stack[top++] = cell;
+    grid->regionOf[cell] = id;
+    while (top > 0) {
+      int curr = stack[--top];
+      int x = curr % grid->tileStride - 1;
+      int y = curr / grid->tileStride - 1;
+      if (x < region->minX) region->minX = x;
+      if (x > region->maxX) region->maxX = x;
+      if (y < region->minY) region->minY = y;
+      if (y > region->maxY) region->maxY = y;
+
+      // the border is solid, so only knight's moves can leave the array
+      int numNeighbors = tile == ROOMTILE ? 16 : 8;
+      for (int n = 0; n < numNeighbors; n++) {
+        int next = curr + neighbors[n][1] * grid->tileStride + neighbors[n][0];
+        if (next >= 0 && next < numTiles && grid->regionOf[next] < 0 
+            && grid->tiles[next] == tile) {
+          grid->regionOf[next] = id;
+          stack[top++] = next;
+        }
+      }
+    }
+  }
+
+  mem_free(stack);
+  return true;
+}
+
 /* ************************ VISION ************************** */
 
 /***** local vision functions *********************************/
@@ -252,329 +834,447 @@ static void
 posToCoordinates(grid_t* grid, int pos, int* tuple)
 {
   // check arguments
-  if( grid == NULL || pos < 0 ){
+  if( grid == NULL || pos < 0 || pos >= grid->mapLen ){
     return;
   } 
   
-  // calculate coordinates, assumes pos is zero indexed
-  int x = (pos % (grid->numColumns + 1)); // add one for new line character not counter in numColumns
-  int y = (pos / (grid->numColumns + 1));
-  tuple[0] = x;
-  tuple[1] = y;
-  
-  // test print statement
-  //fprintf(stdout, "pos %d -> coord: (%d,%d)\n", pos, x, y);
-
-  return;
+  // the tile array has one extra row and column of border before the map
+  int cell = grid->cellOf[pos];
+  tuple[0] = cell % grid->tileStride - 1;
+  tuple[1] = cell / grid->tileStride - 1;
 }
 
 /***** coordinatesToPos ***************************************/
-/* converts cartesian coordinates back into an integer representation */
+/* converts cartesian coordinates back into an integer representation 
+ * returns -1 if there is no map character at those coordinates
+ */
 static int
 coordinatesToPos(grid_t* grid, int x, int y)
 {
-  if( grid == NULL || x < 0 || y < 0 ){
+  if( grid == NULL || x < 0 || y < 0 || x >= grid->numColumns || y >= grid->tileRows ){
     return -1;
   }
-  
-  // where y in the row and x is the column
-  int pos = (y * (grid->numColumns + 1)) + x; // add one to numColumns to account for the new line character
-  
-  // test print statement
-  //fprintf(stdout, "coord (%d,%d) -> pos: %d\n", x, y, pos);
-
-  return pos;
+  return grid->posOf[(y + 1) * grid->tileStride + x + 1];
 }
 
 /***** VISION GLOBAL FUNCTION *********************************/
 
 /***** calculateVision ****************************************/
+/* see grid.h for details
+ * dispatches to the vision engine selected with grid_setVisionMode
+ */
+void
+grid_calculateVision(grid_t* grid, int pos, uint64_t* vision)
+{
+  // check parameters
+  if( grid == NULL || vision == NULL || pos < 0 || pos >= grid->mapLen ){
+    return;
+  }
+
+  if( grid->visionMode == VISION_SHADOWCAST ){
+    shadowcastVision(grid, pos, vision);
+  } else {
+    raycastVision(grid, pos, vision);
+  }
+}
+
+/***** raycastVision ******************************************/
 /* Calculates a player's current vision, 
- * modifies a given integer array representing the player's vision
+ * modifies a given bitset representing the player's vision
+ * a tile is visible if grid_lineOfSight holds between it and the player
  * Parameters:  pos - a player's current position
  *              grid - the grid struct for the map
- *              vision - an integer array with values -1 (not visible), 0 (unvisited) or 1 (visible)
+ *              vision - a bitset of visible tiles
  *
  * Returns:     void
  */
-void
-grid_calculateVision(grid_t* grid, int pos, int* vision)
+static void
+raycastVision(grid_t* grid, int pos, uint64_t* vision)
 { 
-  // check parameters
-  if( grid == NULL || vision == NULL || pos < 0 ){
-    return;
-  }
+  int box[4];                          // minX, minY, maxX, maxY of candidates
 
   // set player position to visible
-  vision[pos] = 1; 
-  // map we check values with, used reference because we don't care about players or gold at this point, but active would also work
-  char* reference = grid_getReference(grid);
+  bitset_set(vision, pos);
+
+  // walk a line from the player to every tile that could possibly be seen
+  visionBounds(grid, pos, box);
+  int fromCell = grid->cellOf[pos];
+  for(int y = box[1]; y <= box[3]; y++){
+    int rowCell = (y + 1) * grid->tileStride + 1;
+    for(int x = box[0]; x <= box[2]; x++){
+      int i = grid->posOf[rowCell + x];
+      if( i >= 0 && lineOfSight(grid, fromCell, rowCell + x) ){
+        bitset_set(vision, i);
+      }
+    }
+  }
+}
 
-  if( reference == NULL ){
-    fprintf(stderr, "calculateVision: error grabbing reference map\n");
-    return;
+/***** visionBounds *******************************************/
+/* finds a box of coordinates holding every tile that could be visible from pos
+ * a line of sight longer than one step passes through one room tile per step,
+ * starting next to pos and ending next to the tile seen; consecutive ones are
+ * neighbors or, where the line passes between tiles, a knight's move apart
+ * so they all lie in one room region, and everything visible is
+ * next to pos or next to a room region touching pos
+ * fills box with minX, minY, maxX, maxY (inclusive), clipped to the map
+ */
+static void
+visionBounds(grid_t* grid, int pos, int* box)
+{
+  int posCell = grid->cellOf[pos];
+  int x = posCell % grid->tileStride - 1;
+  int y = posCell / grid->tileStride - 1;
+
+  // the tiles next to the player are always candidates
+  box[0] = x - 1;
+  box[1] = y - 1;
+  box[2] = x + 1;
+  box[3] = y + 1;
+
+  // add the walls and doorways around every room the player is in or next to
+  // every position has a tile on each side, so no bounds checks are needed
+  for(int dy = -1; dy <= 1; dy++){
+    for(int dx = -1; dx <= 1; dx++){
+      int cell = posCell + dy * grid->tileStride + dx;
+      if( grid->tiles[cell] != ROOMTILE ){
+        continue;
+      }
+      region_t* region = &grid->regions[grid->regionOf[cell]];
+      if( region->minX - 1 < box[0] ) box[0] = region->minX - 1;
+      if( region->minY - 1 < box[1] ) box[1] = region->minY - 1;
+      if( region->maxX + 1 > box[2] ) box[2] = region->maxX + 1;
+      if( region->maxY + 1 > box[3] ) box[3] = region->maxY + 1;
+    }
   }
 
-  // boolean describing whether we've hit a wall/corner
-  bool wallFound = false;
-  
-  // checking cardinal directions manually, because using our algortithm to check horizontal of vertival 'slopes' won't work
-  // position one row up from pos
-  int up = pos - (grid->numColumns + 1);
-
-  while( up > 0 ){ // while we are still within the map
-    if(reference[up] == ROOMTILE && !wallFound){ // marks room squares
-      vision[up] = 1;
-    } 
-    else if(reference[up] != ROOMTILE && !wallFound){ // marks first obstruction in this direction
-      vision[up] = 1;
-      wallFound = true;
-    } else {    // marks non-visible 
-      vision[up] = -1;
+  if( box[0] < 0 ) box[0] = 0;
+  if( box[1] < 0 ) box[1] = 0;
+  if( box[2] >= grid->numColumns ) box[2] = grid->numColumns - 1;
+  if( box[3] >= grid->tileRows ) box[3] = grid->tileRows - 1;
+}
+
+/***** grid_lineOfSight ***************************************/
+/* see grid.h for details */
+bool
+grid_lineOfSight(grid_t* grid, int from, int to)
+{
+  // check parameters
+  if( grid == NULL || grid->tiles == NULL || from < 0 || to < 0
+      || from >= grid->mapLen || to >= grid->mapLen ){
+    return false;
+  }
+  return lineOfSight(grid, grid->cellOf[from], grid->cellOf[to]);
+}
+
+/***** lineOfSight ********************************************/
+/* grid_lineOfSight between two tiles of the tile array
+ * steps one tile at a time along the major axis of the line;
+ * the offset along the minor axis at step k is exactly minor * k / major,
+ * kept as an integer quotient and remainder so no rounding ever happens
+ * every step lies between the endpoints, so inside the border of the array
+ */
+static bool
+lineOfSight(grid_t* grid, int fromCell, int toCell)
+{
+  int stride = grid->tileStride;
+  int dx = toCell % stride - fromCell % stride;
+  int dy = toCell / stride - fromCell / stride;
+  bool xMajor = abs(dx) >= abs(dy);    // true if we step along the x axis
+  int major = xMajor ? abs(dx) : abs(dy);
+  int minor = xMajor ? abs(dy) : abs(dx);
+  // distance in the array of one step along each axis, toward the end tile
+  int stepX = dx < 0 ? -1 : 1;
+  int stepY = dy < 0 ? -stride : stride;
+  int majorStep = xMajor ? stepX : stepY;
+  int minorStep = xMajor ? stepY : stepX;
+
+  // only the tiles strictly between the endpoints can block the line
+  for(int step = 1; step < major; step++){
+    int num = minor * step;            // minor offset is num / major
+    int q = num / major;               // tile at or just before the line
+    int r = num % major;               // nonzero if the line passes between tiles
+    const char* tile = &grid->tiles[fromCell + step * majorStep + q * minorStep];
+
+    // a line through the middle of a tile needs that tile to let light through,
+    // a line between two tiles needs either of them to
+    if( tile[0] != ROOMTILE && (r == 0 || tile[minorStep] != ROOMTILE) ){
+      return false;
     }
+  }
+  return true;
+}
 
-    up -= (grid->numColumns + 1); // parentheses for readability
-  } 
- 
-  // down
-  wallFound = false; // reset wall boolean
-  int down = pos + (grid->numColumns + 1);
-  while( down < grid->mapLen ){
-    if(reference[down] == ROOMTILE && !wallFound){
-      vision[down] = 1;
+/***** VISIBILITY TABLE ***************************************/
+
+/***** grid_buildVisibility ***********************************/
+/* see grid.h for details
+ * the table lives in the grid's layer, so every grid of the same map
+ * and vision mode shares one copy, built by whichever grid asks first
+ */
+bool
+grid_buildVisibility(grid_t* grid)
+{
+  vistable_t built;                    // table built by this call
+  vistable_t* shared;                  // the layer's table for this vision mode
+
+  if( grid == NULL || grid->layer == NULL ){
+    return false;
+  }
+  freeVisibility(grid);
+  shared = &grid->layer->vis[grid->visionMode];
+
+  // another grid of this map may have built it already
+  pthread_mutex_lock(&imagesLock);
+  bool found = shared->runs != NULL;
+  pthread_mutex_unlock(&imagesLock);
+  if( ! found ){
+    // building takes a while, so it is done without the lock,
+    // and a table built at the same time by another grid wins
+    if( ! buildVisTable(grid, &built) ){
+      return false;
     }
-    else if(reference[down] != ROOMTILE && !wallFound){
-      vision[down] = 1;
-      wallFound = true;
-    } else {
-      vision[down] = -1;
+    pthread_mutex_lock(&imagesLock);
+    if( shared->runs == NULL ){
+      *shared = built;
+      built.offsets = built.runs = NULL;
     }
+    pthread_mutex_unlock(&imagesLock);
+    free(built.offsets);
+    free(built.runs);
+  }
+  // a built table never changes, so it can be read without the lock
+  grid->visOffsets = shared->offsets;
+  grid->visRuns = shared->runs;
+  return true;
+}
 
-    down += (grid->numColumns + 1);
+/***** buildVisTable ******************************************/
+/* computes what is visible from every room and passage tile of the grid,
+ * with its current vision mode, into the given table
+ * offsets has mapLen + 1 entries, so the runs for tile i are
+ * runs[2 * offsets[i]] up to (not including) runs[2 * offsets[i + 1]]
+ * both arrays are malloc'd
+ * returns false, leaving the table empty, if memory can't be allocated
+ */
+static bool
+buildVisTable(grid_t* grid, vistable_t* table)
+{
+  uint64_t* vision;                    // scratch vision bitset for one tile
+  int* offsets;                        // first run of each tile
+  int* runs;                           // growing array of (start, length) pairs
+  int* temp;                           // checks realloc success
+  int numRuns = 0;                     // number of runs stored so far
+  int maxRuns = 0;                     // capacity of runs, in pairs
+  size_t words = bitset_words(grid->mapLen); // length of the vision bitset
+
+  table->offsets = table->runs = NULL;
+  if( (offsets = malloc((grid->mapLen + 1) * sizeof(int))) == NULL ){
+    return false;
   }
-  
-  // right
-  wallFound = false;
-  int right = pos + 1;
-  // LEAVE BE, fixes as bug where reference is unexpectedly not able to be referenced 
-  reference = grid_getReference(grid);
+  if( (vision = bitset_new(grid->mapLen)) == NULL ){
+    free(offsets);
+    return false;
+  }
+  maxRuns = grid->numRows > 0 ? grid->numRows : 1;
+  if( (runs = malloc(2 * maxRuns * sizeof(int))) == NULL ){
+    bitset_delete(vision);
+    free(offsets);
+    return false;
+  }
+
+  for(int pos = 0; pos < grid->mapLen; pos++){
+    offsets[pos] = numRuns;
 
-  while( reference[right] != '\n' ){ // within the current line
-    if(reference[right] == ROOMTILE && !wallFound){
-      vision[right] = 1;
+    // only tiles a player can stand on get an entry
+    if( grid->reference[pos] != ROOMTILE && grid->reference[pos] != PASSAGETILE ){
+      continue;
     }
-    else if(reference[right] != ROOMTILE && !wallFound){
-      vision[right] = 1;
-      wallFound = true;
-    } else {
-      vision[right] = -1;
+
+    bitset_clear(vision, words);
+    grid_calculateVision(grid, pos, vision);
+
+    // compress the visible positions into runs
+    int start = bitset_next(vision, words, 0);
+    while( start >= 0 ){
+      int i = start;
+      while( i < grid->mapLen && bitset_test(vision, i) ){
+        i++;
+      }
+
+      // grow the run array as needed
+      if( numRuns == maxRuns ){
+        maxRuns *= 2;
+        if( (temp = realloc(runs, 2 * maxRuns * sizeof(int))) == NULL ){
+          free(runs);
+          bitset_delete(vision);
+          free(offsets);
+          return false;
+        }
+        runs = temp;
+      }
+      runs[2 * numRuns] = start;
+      runs[2 * numRuns + 1] = i - start;
+      numRuns++;
+      start = bitset_next(vision, words, i);
     }
+  }
+  offsets[grid->mapLen] = numRuns;
+
+  // shrink to fit, keeping the larger array if that fails
+  if( (temp = realloc(runs, 2 * (numRuns > 0 ? numRuns : 1) * sizeof(int))) != NULL ){
+    runs = temp;
+  }
+  bitset_delete(vision);
+  table->offsets = offsets;
+  table->runs = runs;
+  return true;
+}
 
-    right++;
+/***** grid_lookupVisibility **********************************/
+/* see grid.h for details */
+int
+grid_lookupVisibility(grid_t* grid, int pos, const int** runs)
+{
+  if( grid == NULL || runs == NULL || grid->visRuns == NULL
+      || pos < 0 || pos >= grid->mapLen ){
+    return 0;
   }
 
-  // left
-  wallFound = false;
-  int left = pos - 1;
-  while( reference[left] != '\n' && left >= 0 ){
-    if(reference[left] == ROOMTILE && !wallFound){
-      vision[left] = 1;
-    }
-    else if(reference[left] != ROOMTILE && !wallFound){
-      vision[left] = 1;
-      wallFound = true;
-    } else {
-      vision[left] = -1;
-    }
+  *runs = &grid->visRuns[2 * grid->visOffsets[pos]];
+  return grid->visOffsets[pos + 1] - grid->visOffsets[pos];
+}
 
-    left--;
-  }  
+/***** freeVisibility *****************************************/
+/* stops the grid using its visibility table, if it has one
+ * the table itself belongs to the layer, and goes when the layer does
+ */
+static void
+freeVisibility(grid_t* grid)
+{
+  grid->visOffsets = NULL;
+  grid->visRuns = NULL;
+}
 
-  // convert from integer to cartesian coordinates
+/***** deleteLayer ********************************************/
+/* frees a layer no grid uses any more, with its visibility tables */
+static void
+deleteLayer(layer_t* layer)
+{
+  for(int mode = 0; mode <= VISION_SHADOWCAST; mode++){
+    free(layer->vis[mode].offsets);
+    free(layer->vis[mode].runs);
+  }
+  free(layer->block);
+  mem_free(layer);
+}
+
+/***** SHADOWCASTING *****************************************/
+
+/* multipliers that map octant-local (dx, dy) onto map (x, y)
+ * each row is {xx, xy, yx, yy}, one row per octant around the player
+ */
+static const int octants[8][4] = {
+  { 1,  0,  0,  1}, { 0,  1,  1,  0}, { 0, -1,  1,  0}, {-1,  0,  0,  1},
+  {-1,  0,  0, -1}, { 0, -1, -1,  0}, { 0,  1, -1,  0}, { 1,  0,  0, -1}
+};
+
+/***** isTransparent ******************************************/
+/* returns true if light passes through the tile at (x, y)
+ * only room tiles are transparent; walls, passages and anything
+ * outside the map block line of sight
+ */
+static bool
+isTransparent(grid_t* grid, int x, int y)
+{
+  if( x < 0 || y < 0 || x >= grid->numColumns || y >= grid->tileRows ){
+    return false;
+  }
+  return grid->tiles[(y + 1) * grid->tileStride + x + 1] == ROOMTILE;
+}
+
+/***** shadowcastVision ***************************************/
+/* recursive shadowcasting vision engine
+ * lights the player's tile, then casts light into each of the eight octants
+ * only tiles that end up visible are written to the vision array,
+ * and only tiles inside an unblocked part of an octant are ever read
+ */
+static void
+shadowcastVision(grid_t* grid, int pos, uint64_t* vision)
+{
   int posCoor[2];
   posToCoordinates(grid, pos, posCoor);
-  // will store the current point under consideration
-  int pointCoor[2];
-  // slope of line
-  double m = 0.0;
-  // iterate through points in the grid
-  for(int i = 0; i < grid->mapLen; i++){
-    // grabbing reference grid, fixes issue where we are unexpectedly unable to use the reference grid
-    reference = grid_getReference(grid);
-    wallFound = false;
-    if( vision[i] == 0 ){ // point hasn't been visited
-      posToCoordinates(grid, i, pointCoor);
-
-      // slope formula
-      m = (double)(pointCoor[1] - posCoor[1]) / (double)(pointCoor[0] - posCoor[0]);
-      // slope squared, useful for checking whether the abs value of a slope is greater or less than 1 
-      double mSqr = m*m;
-      // boolean variable which determines we step left/right or up/down
-      bool direction;
-      if( mSqr <= 1 ){ // determining whether we step along the y axis or the x axis 
-        direction = (posCoor[0] < pointCoor[0]); // determining whether the point is right or left of pos
-      } else {
-        direction = (posCoor[1] < pointCoor[1]); // determining whether the point is above or below pos
+
+  bitset_set(vision, pos);
+  for(int i = 0; i < 8; i++){
+    castLight(grid, vision, posCoor[0], posCoor[1], 1, 1.0, 0.0, octants[i]);
+  }
+}
+
+/***** castLight **********************************************/
+/* scans one octant row by row, starting at distance 'row' from the player
+ * 'start' and 'end' are the slopes bounding the lit part of the octant
+ * when a run of opaque tiles is found, the lit region beyond it is
+ * scanned recursively and the remainder of the row continues past the shadow
+ */
+static void
+castLight(grid_t* grid, uint64_t* vision, int px, int py, int row,
+          double start, double end, const int* octant)
+{
+  // furthest any tile in the map can be from the player
+  int radius = grid->numColumns > grid->tileRows ? grid->numColumns : grid->tileRows;
+  double newStart = 0.0;               // start slope of the next lit region
+
+  if( start < end ){
+    return;
+  }
+
+  for(int j = row; j <= radius; j++){
+    bool blocked = false;              // true while scanning a run of walls
+    int dy = -j;
+
+    for(int dx = -j; dx <= 0; dx++){
+      // slopes to the left and right edges of this tile
+      double lSlope = (dx - 0.5) / (dy + 0.5);
+      double rSlope = (dx + 0.5) / (dy - 0.5);
+
+      if( start < rSlope ){            // tile is left of the lit region
+        continue;
+      } else if( end > lSlope ){       // tile is right of the lit region
+        break;
       }
 
-      if( direction ){
-        int diff;
-        // deciding whether to walk along the x axis or the y axis
-        if( mSqr <=1 ){
-          diff = pointCoor[0] - posCoor[0]; // difference between the x coords
-        } else {
-          diff = pointCoor[1] - posCoor[1]; // difference between y coords
-        }
+      // translate into map coordinates
+      int x = px + dx * octant[0] + dy * octant[1];
+      int y = py + dx * octant[2] + dy * octant[3];
+      bool opaque = ! isTransparent(grid, x, y);
 
-        int step = 1; // step interval
-        double currVal = 0.0; // current dependentx or y value, depending on the axis we step allong
-
-        // walk from pos to point, checking values along the way
-        while( step <= diff ){
-          if( mSqr <= 1 ){
-            currVal = (m * step) + posCoor[1]; // y = mx + b
-          } else {
-            currVal = posCoor[0] + (step/m); // x = b + y/m
-          }
-
-          int rounded = (int) currVal;
-          int mid = (int) (currVal + 0.5);
-          double roundedD = (double) rounded;
-          
-          if( currVal == roundedD ){ // the case where currVal lies exactly on a point
-            int currPos;
-            if( mSqr <= 1 ){
-              currPos = coordinatesToPos(grid, posCoor[0] + step, (int) currVal); // grab int representation
-            } else {
-              currPos = coordinatesToPos(grid, (int) currVal, posCoor[1] + step);
-            }
-
-            if( (reference[currPos] == ROOMTILE || isalpha(reference[currPos]) != 0) && !wallFound ){  // check if room tile or player
-              vision[currPos] = 1;
-            }
-            else if( reference[currPos] != ROOMTILE && !wallFound ){ // check if this is the first wall we've seen
-              vision[currPos] = 1;
-              wallFound = true;
-            } else { // otherwise we've already seen a wall, so this point is not visible
-              if(vision[currPos] == 0){
-                vision[currPos] = -1;
-              }
-            }
-          } else { // the more likely case currVal falls between two points and we need to check both
-            int pos1; 
-            int pos2;
-            int midPos;
-            if( mSqr <= 1){
-              pos1 = coordinatesToPos(grid, posCoor[0] + step, rounded);    // the two positions in reference we need to check
-              pos2 = coordinatesToPos(grid, posCoor[0] + step, rounded + 1);
-              midPos = coordinatesToPos(grid, posCoor[0] + step, mid);
-            } else {
-              pos1 = coordinatesToPos(grid, rounded, posCoor[1] + step);
-              pos2 = coordinatesToPos(grid, rounded + 1, posCoor[1] + step);
-              midPos = coordinatesToPos(grid, mid, posCoor[1] + step);
-            }
-            
-            if( (reference[midPos] == ROOMTILE || isalpha(reference[mid]) != 0) && !wallFound ){ // haven't hit a wall yet, and current position is between room tiles
-              vision[pos1] = 1;
-              vision[pos2] = 1;
-            }
-            else if(!wallFound){ // haven't found a wall yet, but the current position hits a wall
-              vision[pos1] = 1;
-              vision[pos2] = 1;
-              wallFound = true;
-
-            } else { // we've already see a wall, current position is not visible
-              if(vision[pos1] == 0){
-                vision[pos1] = -1;
-              }
-              if(vision[pos2] == 0){
-                vision[pos2] = -1;
-              }
-            }
-          }
-          step++; // increment current x
-        }
-      } else { // it must be the case that posCoor[0] > pointCoor[0]
-        int diff;
-        if( mSqr <= 1 ){
-          diff = posCoor[0] - pointCoor[0];
-        } else {
-          diff = posCoor[1] - pointCoor[1];
-        }
+      // anything lit inside the map is visible, including the wall that stops the light
+      int tile = coordinatesToPos(grid, x, y);
+      if( tile >= 0 ){
+        bitset_set(vision, tile);
+      }
 
-        int step = 1;
-        double currVal = 0.0; 
-
-        while( step <= diff ){
-
-          if( mSqr <=1 ){
-            currVal = posCoor[1] - (m * step); // y = mx + b 
-          } else {
-            currVal = posCoor[0] - (step/m);
-          }
-
-          int rounded = (int) currVal;
-          int mid = (int) (currVal + 0.5);
-          double roundedD = (double) rounded;
-
-          if( currVal == roundedD ){ // we have the case where the point falls exactly on a point in a map (not between two points)
-            int currPos;
-            if( mSqr <= 1 ){
-              currPos = coordinatesToPos(grid, posCoor[0] - step, (int)currVal);
-            } else {
-              currPos = coordinatesToPos(grid, (int) currVal, posCoor[1] - step);
-            }
-
-            if( (reference[currPos] == ROOMTILE || isalpha(currPos) != 0 ) && !wallFound ){
-              vision[currPos] = 1;
-            }
-            else if( reference[currPos] != ROOMTILE && !wallFound ){
-              vision[currPos] = 1;
-              wallFound = true;
-            } else {
-              if(vision[currPos] == 0){
-              vision[currPos] = -1;
-              }
-            }
-          } else { // otherwise the point falls between two points in the map and we must check both
-            int pos1;
-            int pos2;
-            int midPos;
-
-            if( mSqr <= 1 ){
-              pos1 = coordinatesToPos(grid, posCoor[0] - step, rounded);
-              pos2 = coordinatesToPos(grid, posCoor[0] - step, rounded + 1);
-              midPos = coordinatesToPos(grid, posCoor[0] - step, mid);
-            } else {
-              pos1 = coordinatesToPos(grid, rounded, posCoor[1] - step);
-              pos2 = coordinatesToPos(grid, rounded + 1, posCoor[1] - step);
-              midPos = coordinatesToPos(grid, mid, posCoor[1] - step);
-            }
-            
-            if( (reference[midPos] == ROOMTILE || isalpha(reference[midPos]) != 0 ) && !wallFound){
-              vision[pos1] = 1;
-              vision[pos2] = 1;
-            }
-            else if(!wallFound){
-              vision[pos1] = 1;
-              vision[pos2] = 1;
-              wallFound = true;
-            } else {
-              if(vision[pos1] == 0){
-                vision[pos1] = -1;
-              }
-              if(vision[pos2] == 0){
-                vision[pos2] = -1;
-              }
-            }
-          } 
-          step++;
+      if( blocked ){
+        if( opaque ){                  // still in shadow
+          newStart = rSlope;
+        } else {                       // shadow ended, continue with narrowed region
+          blocked = false;
+          start = newStart;
         }
+      } else if( opaque && j < radius ){
+        // first wall of a run, light the region beyond it before moving on
+        blocked = true;
+        castLight(grid, vision, px, py, j + 1, start, lSlope, octant);
+        newStart = rSlope;
       }
     }
+
+    // whole remainder of the octant is in shadow
+    if( blocked ){
+      return;
+    }
   }
-  
-  return;
 }
 
 
@@ -586,7 +1286,7 @@ int main(const int argc, char* argv[])
   FILE* fp = NULL;                     // map file to read from
   grid_t* grid = NULL;                 // testing grid
   char* active = NULL;                 // active map
-  char* reference = NULL;              // reference map
+  const char* reference = NULL;        // reference map
 
   // test command line args
   if (argc != 2) {
@@ -602,7 +1302,7 @@ int main(const int argc, char* argv[])
   fclose(fp);
 
   // create grid from file
-  grid = grid_new(argv[1]);
+  grid = grid_new(argv[1], NULL);
   if (grid == NULL) {
     fprintf(stderr, "grid creation failure\n");
   }
@@ -639,6 +1339,7 @@ int main(const int argc, char* argv[])
   }
 
   grid_delete(grid);
+  grid_clearMapCache();
   // exit successfully after test completion
   exit(0);
 }
@@ -649,8 +1350,8 @@ int main(const int argc, char* argv[])
 int 
 main(int argc, char* argv[])
 {
- // check args
- if( argc != 2 ){
+ // check args, an optional second arg selects the vision engine
+ if( argc != 2 && argc != 3 ){
    fprintf(stderr, "Invalid num args\n");
    exit(1);
  }
@@ -664,24 +1365,28 @@ main(int argc, char* argv[])
  fclose(fp);
   
  // create new grid
- grid_t* grid = grid_new(argv[1]);
+ grid_t* grid = grid_new(argv[1], NULL);
  if( grid == NULL ){
    fprintf(stderr, "Grid creation failure\n");
    exit(3);
  }
+
+ // "shadowcast" runs the same positions through the shadowcasting engine
+ if( argc == 3 && strcmp(argv[2], "shadowcast") == 0 ){
+   grid_setVisionMode(grid, VISION_SHADOWCAST);
+ }
  
- // initialize vision array to correct size
- int vision[grid->mapLen];
+ // initialize vision bitset to correct size
+ size_t words = grid_getVisionWords(grid);
+ uint64_t vision[words];
  // specific location chosen to illustrate features vision behavior with corners
  int pos = 1447;
  // initialize vision to zeros
- for(int i = 0; i < grid->mapLen; i++){
-  vision[i] = 0;
- }
+ bitset_clear(vision, words);
  // populate vision array
  grid_calculateVision(grid, pos, vision); 
  fprintf(stdout, "\n");
- char* reference = grid_getReference(grid);
+ const char* reference = grid_getReference(grid);
 
  for(int i = 0; i < grid->mapLen; i++){
    // print player location as @ char
@@ -691,7 +1396,7 @@ main(int argc, char* argv[])
    else if(i % (grid->numColumns+1)==0 && i != 0){
      fprintf(stdout, "\n");
    }
-   else if(vision[i] == 1 && reference[i] != '\n'){
+   else if(bitset_test(vision, i) && reference[i] != '\n'){
       fprintf(stdout, "%c", reference[i]);
    } else {
       fprintf(stdout, " ");
@@ -703,9 +1408,7 @@ main(int argc, char* argv[])
  // testing with a new position this time in a tunnel
  pos = 592;
  // resetting vision
- for(int i = 0; i < grid->mapLen; i++){
-  vision[i] = 0;
- }
+ bitset_clear(vision, words);
  // repopulate vision array
  grid_calculateVision(grid, pos, vision);
  fprintf(stdout, "\n----- map boundary ------------------------------------------------------------\n");
@@ -717,7 +1420,7 @@ main(int argc, char* argv[])
    else if( i == pos ){
      fprintf(stdout, "@");
    }
-   else if( vision[i] == 1){
+   else if( bitset_test(vision, i)){
     fprintf(stdout, "%c", reference[i]);
    } else {
      fprintf(stdout, " ");
@@ -727,9 +1430,7 @@ main(int argc, char* argv[])
 
  // testing a third position
  pos = 1055;
- for(int i = 0; i < grid->mapLen; i++){
-   vision[i] = 0;
- }
+ bitset_clear(vision, words);
  grid_calculateVision(grid, pos, vision);
  fprintf(stdout, "\n----- map boundary ------------------------------------------------------------\n");
 
@@ -740,7 +1441,7 @@ main(int argc, char* argv[])
    else if( i == pos ){
      fprintf(stdout, "@");
    }
-   else if( vision[i] == 1 ){
+   else if( bitset_test(vision, i) ){
      fprintf(stdout, "%c", reference[i]);
    } else {
      fprintf(stdout, " ");
@@ -748,7 +1449,20 @@ main(int argc, char* argv[])
  }
  fprintf(stdout, "\n");
 
+ // line of sight must agree in both directions, from each test position to every tile
+ int testPositions[3] = {1447, 592, 1055};
+ int asymmetric = 0;
+ for(int p = 0; p < 3; p++){
+   for(int i = 0; i < grid->mapLen; i++){
+     if( grid_lineOfSight(grid, testPositions[p], i) != grid_lineOfSight(grid, i, testPositions[p]) ){
+       asymmetric++;
+     }
+   }
+ }
+ fprintf(stdout, "lineOfSight asymmetric pairs: %d\n", asymmetric);
+
  grid_delete(grid);
+ grid_clearMapCache();
  
  exit(0); 
 }
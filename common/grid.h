@@ -21,19 +21,58 @@
 #define __GRID_H
 
 #include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+#include "mem.h"
 
 /**************** global types ****************/
 typedef struct grid grid_t;  // opaque to users of the module
 
+/* the algorithm grid_calculateVision uses to decide what a player can see
+ * VISION_RAYCAST tests grid_lineOfSight from the player to every tile that could
+ * be in sight: those around the player and around the rooms next to them
+ * VISION_SHADOWCAST sweeps the eight octants around the player,
+ * only visiting tiles that could be lit
+ */
+typedef enum visionmode {
+  VISION_RAYCAST,
+  VISION_SHADOWCAST
+} visionmode_t;
+
 /**************** functions **************/
 
 /**************** getters **************/
-char* grid_getReference(grid_t* grid);
+/* the reference map is shared by every grid made from the same map file
+ * and must not be modified */
+const char* grid_getReference(grid_t* grid);
 char* grid_getActive(grid_t* grid);
+/* the active map preceded by "DISPLAY\n": a DISPLAY message ready to send,
+ * kept in place in front of the active map so it never has to be copied */
+const char* grid_getDisplay(grid_t* grid);
 int grid_getNumRows(grid_t* grid);
 int grid_getNumColumns(grid_t* grid);
 size_t grid_getMapLen(grid_t* grid);
 char* grid_getMapfile(grid_t* grid);
+visionmode_t grid_getVisionMode(grid_t* grid);
+
+/* number of 64-bit words in a vision bitset for this grid, one bit per map position */
+size_t grid_getVisionWords(grid_t* grid);
+
+/* grid_new splits the map into regions: areas of room tiles, or of passage tiles,
+ * connected horizontally, vertically or diagonally, numbered from 0
+ * grid_getRegion returns the region of the tile at pos, 
+ * or -1 if it is not a room or passage tile or the parameters are invalid
+ */
+int grid_getNumRegions(grid_t* grid);
+int grid_getRegion(grid_t* grid, int pos);
+
+/**************** setters **************/
+/* sets the algorithm used by grid_calculateVision on the given grid
+ * grids default to VISION_RAYCAST
+ * discards any visibility table built with the previous mode
+ * returns true on success, false if grid is NULL or mode unknown
+ */
+bool grid_setVisionMode(grid_t* grid, visionmode_t mode);
 
 /**************** grid_new ***************/
 /* initialize a new "grid"
@@ -41,15 +80,32 @@ char* grid_getMapfile(grid_t* grid);
  * allocates memory for the map string and struct itself 
  * that must then be free'd in grid_delete 
  * also stores the number of rows and columns in the grid within the struct
+ * each map file is only read and parsed the first time it is passed in;
+ * every grid made from it shares one read-only copy of the reference map,
+ * tile array and regions, and only the active map is the grid's own
+ * changes to the file are not seen until grid_clearMapCache is called
+ * the grid's own memory, and anything it allocates later, comes from the given
+ * arena (see mem.h), or from malloc if arena is NULL; grid_delete then only frees
+ * what did not come from the arena, which must outlive the grid
+ * safe to call from several threads at once, unless they share an arena
  * returns the grid if process successful
  * returns NULL if error at any point in the process (including allocating memory)
  */
-grid_t* grid_new(char* mapFile);
+grid_t* grid_new(char* mapFile, mem_arena_t* arena);
+
+/**************** grid_clearMapCache ***************/
+/* forgets the parsed image of every map read by grid_new
+ * grids already created are unaffected: the read-only data they share
+ * is freed when the last of them is deleted
+ * call before exiting, once no more grids will be made
+ */
+void grid_clearMapCache(void);
 
 /*************** grid_replace *************/
 /* replace the given character at the given index position in the map string
  * modifies the "active map" of the given grid structure 
  * at the given index position, replacing it with the given character
+ * if the character actually changes, the position is marked dirty (see grid_getDirty)
  * returns true if success, false if error
  */
 bool grid_replace(grid_t* grid, int pos, char newChar);
@@ -58,19 +114,65 @@ bool grid_replace(grid_t* grid, int pos, char newChar);
 /* Replaces the character at the given position of the given grid's active map
  * with the character at the same position in the given grid's reference map
  * most often used when players move or when gold is picked up
+ * marks the position dirty if the character actually changes
  * returns true if success, false if the strings in the given grid don't exist
  */
 bool grid_revertTile(grid_t* grid, int pos);
 
+/**************** grid_markDirty **************/
+/* marks the position dirty without changing the active map,
+ * for changes that don't show on it, like two players drawn with the same
+ * letter swapping places
+ * returns false if grid is NULL or pos is out of range
+ */
+bool grid_markDirty(grid_t* grid, int pos);
+
+/**************** grid_getDirty **************/
+/* returns the bitset (see bitset.h) of active map positions changed
+ * by grid_replace or grid_revertTile since the last grid_clearDirty
+ * the bitset is owned by the grid and holds grid_getVisionWords(grid) words
+ * returns NULL if grid is NULL
+ */
+const uint64_t* grid_getDirty(grid_t* grid);
+
+/**************** grid_clearDirty **************/
+/* forgets all changes recorded in the grid's dirty bitset */
+void grid_clearDirty(grid_t* grid);
+
+/**************** grid_neighbor **************/
+/* returns the position of the tile dx columns right and dy rows down 
+ * from the given position, where dx and dy are each -1, 0 or 1
+ * rows are matched up as displayed, even if they differ in length
+ * returns -1 if there is no map character there (past the edge of the map 
+ * or the end of a row), or if the parameters are invalid
+ */
+int grid_neighbor(grid_t* grid, int pos, int dx, int dy);
+
 /************ grid_containsEmptyTile *********/
 /* allows a user to determine whether or not a given grid's active map 
  * contains an empty room tile. Most useful when adding a player
  * because it determines whether a player can be added or not
+ * takes constant time once the grid's index of empty tiles is built (see below)
  * returns true if there is at least one ROOMTILE ('.')
  * false if there is not
  */
 bool grid_containsEmptyTile(grid_t* grid);
 
+/************ grid_getNumEmptyTiles *********/
+/* the grid keeps an index of the empty room tiles ('.') in its active map,
+ * built the first time one of these three functions is called on it
+ * and then updated by grid_replace and grid_revertTile in constant time,
+ * so once it exists the active map must only be changed through those functions
+ * grid_getNumEmptyTiles returns the number of empty room tiles,
+ * or 0 if the grid is NULL or the index can't be allocated
+ * grid_getEmptyTile returns the position of the index'th of them,
+ * for 0 <= index < grid_getNumEmptyTiles(grid), or -1 if index is out of range
+ * their order is arbitrary, and changes as tiles are filled and emptied,
+ * so grid_getEmptyTile(grid, rand() % n) picks an empty tile uniformly
+ */
+int grid_getNumEmptyTiles(grid_t* grid);
+int grid_getEmptyTile(grid_t* grid, int index);
+
 /*************** grid_delete **************/
 /* free's all memory in use by the given grid
  * checks for existence of strings before deleting them
@@ -79,14 +181,51 @@ bool grid_containsEmptyTile(grid_t* grid);
 void grid_delete(grid_t* grid);
 
 /********** grid_calculateVision ***********/
-/* Calculates a player's current vision, in the form of an integer array the same size as our map
- * indicating which points are visible with a 1 indicating visibility or -1 indicating non-visibility
- * modifies the given array
+/* Calculates a player's current vision, in the form of a bitset with one bit per map position
+ * (see bitset.h), where a set bit indicates the point is visible
+ * sets bits in the given bitset, which the caller must clear beforehand
+ * and which must hold at least grid_getVisionWords(grid) words
+ * the algorithm used is chosen by grid_setVisionMode
  * Parameters:  grid - the grid of the map we are playing the game on 
  *              pos - a players position within the map (int)
- *              vision - the int array which stores corresponding visibility information 
+ *              vision - the bitset which stores corresponding visibility information 
  * Returns:     void
  */
-void grid_calculateVision(grid_t* grid, int pos, int* vision);
+void grid_calculateVision(grid_t* grid, int pos, uint64_t* vision);
+
+/********** grid_lineOfSight ***********/
+/* Determines whether there is an unobstructed line of sight between two map positions
+ * the line is checked at each step along its longer axis, strictly between the two positions
+ * where it passes through a tile, that tile must let light through (be a room tile);
+ * where it passes between two tiles, either one letting light through is enough
+ * uses only integer arithmetic, and is symmetric: 
+ * grid_lineOfSight(grid, a, b) == grid_lineOfSight(grid, b, a)
+ * the endpoints themselves never block, so walls bounding a room are in sight
+ * Returns:     true if there is a line of sight, false if blocked or parameters invalid
+ */
+bool grid_lineOfSight(grid_t* grid, int from, int to);
+
+/********** grid_buildVisibility ***********/
+/* Precomputes what is visible from every room and passage tile of the grid
+ * the reference map never changes during a game, so neither does this table
+ * each tile's visible set is stored compressed, as runs of consecutive positions
+ * uses the vision engine currently selected on the grid
+ * the table is shared, like the reference map, by every grid made from the same
+ * map file with the same vision engine: only the first call builds it,
+ * later ones, from any of those grids, just look it up
+ * must be called again after changing vision mode
+ * safe to call from several threads at once
+ * Returns:     true on success, false if grid is NULL or memory can't be allocated
+ */
+bool grid_buildVisibility(grid_t* grid);
+
+/********** grid_lookupVisibility ***********/
+/* Looks up the precomputed visible set for the given position
+ * sets *runs to an array of (start, length) pairs owned by the grid,
+ * each pair describing a run of consecutive visible positions in the map string
+ * Returns:     the number of runs, or 0 if no table was built for this position
+ *              in which case the caller should fall back to grid_calculateVision
+ */
+int grid_lookupVisibility(grid_t* grid, int pos, const int** runs);
 
 #endif
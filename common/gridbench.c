@@ -0,0 +1,238 @@
+/*
+ * gridbench.c - micro-benchmark of the grid and player vision code
+ *
+ * usage: ./gridbench map.txt...
+ *
+ * For every map given, times:
+ *   grid_new/parse              reading and parsing the map (loadRepeats times)
+ *   grid_new/clone              copying a grid from the parsed map (loadRepeats times)
+ *   grid_new/arena              the same, allocating the copies from one arena
+ *   grid_calculateVision/ENGINE vision from every floor tile, with each engine
+ *   player_updateVision/table   a player walking over every floor tile,
+ *                               with the grid's visibility table built
+ *   player_updateVision/calc    the same walk, calculating vision every step
+ *
+ * Prints one tab-separated line per map and operation to stdout, after a header:
+ *   map  op  n  p50_ns  p90_ns  p99_ns  max_ns
+ * where n is the number of timed calls and the rest are nanoseconds per call
+ * Maps that can't be loaded are reported on stderr and skipped
+ * exits 0 unless called with no maps
+ *
+ * Winter 2022, CS50 team 1
+ */
+
+#define _POSIX_C_SOURCE 199309L        // clock_gettime
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <time.h>
+#include "grid.h"
+#include "player.h"
+#include "bitset.h"
+#include "mem.h"
+
+static const int loadRepeats = 20;     // times each map is loaded
+static const char ROOMTILE = '.';      // char representation of room floor
+static const char PASSAGETILE = '#';   // char representation of passage tile
+
+/**************** local functions ****************/
+static bool benchMap(char* mapfile);
+static void benchLoad(char* mapfile, bool parse, mem_arena_t* arena, int64_t* samples);
+static int benchVision(grid_t* grid, visionmode_t mode, int64_t* samples);
+static int benchUpdate(char* mapfile, bool useTable, int64_t* samples);
+static void report(char* mapfile, const char* op, int64_t* samples, int n);
+static int64_t percentile(const int64_t* sorted, int n, int p);
+static int compareSamples(const void* a, const void* b);
+static int64_t now();
+
+/******************** main *******************/
+int
+main(const int argc, char* argv[])
+{
+  if (argc < 2) {
+    fprintf(stderr, "usage: %s map.txt...\n", argv[0]);
+    exit(1);
+  }
+
+  printf("map\top\tn\tp50_ns\tp90_ns\tp99_ns\tmax_ns\n");
+  for (int i = 1; i < argc; i++) {
+    if ( ! benchMap(argv[i])) {
+      fprintf(stderr, "%s: skipping %s, could not load map\n", argv[0], argv[i]);
+    }
+  }
+  grid_clearMapCache();
+  exit(0);
+}
+
+/******************** benchMap *******************/
+/* runs and reports every benchmark on one map
+ * returns false if the map could not be loaded
+ */
+static bool
+benchMap(char* mapfile)
+{
+  grid_t* grid;                        // map being benchmarked
+  int64_t* samples;                    // time of each call, in ns
+  size_t maxSamples;                   // room in samples
+  int n;                               // samples taken
+
+  if ((grid = grid_new(mapfile, NULL)) == NULL) {
+    return false;
+  }
+  maxSamples = grid_getMapLen(grid) > loadRepeats ? grid_getMapLen(grid) : loadRepeats;
+  samples = mem_malloc_assert(maxSamples * sizeof(int64_t), "gridbench: samples\n");
+
+  benchLoad(mapfile, true, NULL, samples);
+  report(mapfile, "grid_new/parse", samples, loadRepeats);
+  benchLoad(mapfile, false, NULL, samples);
+  report(mapfile, "grid_new/clone", samples, loadRepeats);
+  mem_arena_t* arena = mem_arena_new(0);
+  if (arena != NULL) {
+    benchLoad(mapfile, false, arena, samples);
+    report(mapfile, "grid_new/arena", samples, loadRepeats);
+    mem_arena_delete(arena);
+  }
+
+  n = benchVision(grid, VISION_RAYCAST, samples);
+  report(mapfile, "grid_calculateVision/raycast", samples, n);
+  n = benchVision(grid, VISION_SHADOWCAST, samples);
+  report(mapfile, "grid_calculateVision/shadowcast", samples, n);
+
+  n = benchUpdate(mapfile, true, samples);
+  report(mapfile, "player_updateVision/table", samples, n);
+  n = benchUpdate(mapfile, false, samples);
+  report(mapfile, "player_updateVision/calc", samples, n);
+
+  mem_free(samples);
+  grid_delete(grid);
+  return true;
+}
+
+/******************** benchLoad *******************/
+/* times loading the map loadRepeats times, 
+ * from the file if parse, otherwise from grid_new's parsed copy,
+ * allocating from the given arena, which may be NULL
+ */
+static void
+benchLoad(char* mapfile, bool parse, mem_arena_t* arena, int64_t* samples)
+{
+  for (int i = 0; i < loadRepeats; i++) {
+    if (parse) {
+      grid_clearMapCache();
+    }
+    int64_t start = now();
+    grid_t* grid = grid_new(mapfile, arena);
+    samples[i] = now() - start;
+    grid_delete(grid);
+  }
+}
+
+/******************** benchVision *******************/
+/* times grid_calculateVision from every floor tile with the given engine
+ * returns the number of samples taken
+ */
+static int
+benchVision(grid_t* grid, visionmode_t mode, int64_t* samples)
+{
+  char* reference = grid_getActive(grid); // nothing placed yet, so active == reference
+  size_t words = grid_getVisionWords(grid);
+  uint64_t* vision = bitset_new(grid_getMapLen(grid));
+  int n = 0;
+
+  grid_setVisionMode(grid, mode);
+  for (int pos = 0; pos < grid_getMapLen(grid); pos++) {
+    if (reference[pos] != ROOMTILE && reference[pos] != PASSAGETILE) {
+      continue;
+    }
+    bitset_clear(vision, words);
+    int64_t start = now();
+    grid_calculateVision(grid, pos, vision);
+    samples[n++] = now() - start;
+  }
+  bitset_delete(vision);
+  return n;
+}
+
+/******************** benchUpdate *******************/
+/* times player_updateVision as a player steps onto every floor tile in turn
+ * on a freshly loaded grid, as the server would use it:
+ * with a raycast visibility table if useTable, calculating vision otherwise
+ * returns the number of samples taken
+ */
+static int
+benchUpdate(char* mapfile, bool useTable, int64_t* samples)
+{
+  grid_t* grid = grid_new(mapfile, NULL);
+  player_t* player = player_new("bench", mapfile, NULL);
+  int n = 0;
+
+  if (grid == NULL || player == NULL) {
+    grid_delete(grid);
+    player_delete(player);
+    return 0;
+  }
+  if (useTable) {
+    grid_buildVisibility(grid);
+  }
+  char* reference = grid_getActive(grid);
+
+  for (int pos = 0; pos < grid_getMapLen(grid); pos++) {
+    if (reference[pos] != ROOMTILE && reference[pos] != PASSAGETILE) {
+      continue;
+    }
+    player_setPos(player, pos);
+    int64_t start = now();
+    player_updateVision(player, grid, NULL);
+    samples[n++] = now() - start;
+  }
+  player_delete(player);
+  grid_delete(grid);
+  return n;
+}
+
+/******************** report *******************/
+/* prints one result line for the given samples, which it sorts
+ * prints nothing if there are no samples
+ */
+static void
+report(char* mapfile, const char* op, int64_t* samples, int n)
+{
+  if (n <= 0) {
+    return;
+  }
+  qsort(samples, n, sizeof(int64_t), compareSamples);
+  printf("%s\t%s\t%d\t%lld\t%lld\t%lld\t%lld\n", mapfile, op, n,
+         (long long)percentile(samples, n, 50), (long long)percentile(samples, n, 90),
+         (long long)percentile(samples, n, 99), (long long)samples[n - 1]);
+}
+
+/******************** percentile *******************/
+/* returns the p-th percentile of n sorted samples, by nearest rank */
+static int64_t
+percentile(const int64_t* sorted, int n, int p)
+{
+  int rank = (p * n + 99) / 100;
+  return sorted[rank > 0 ? rank - 1 : 0];
+}
+
+/******************** compareSamples *******************/
+/* qsort comparator for int64_t, ascending */
+static int
+compareSamples(const void* a, const void* b)
+{
+  int64_t x = *(const int64_t*)a;
+  int64_t y = *(const int64_t*)b;
+  return (x > y) - (x < y);
+}
+
+/******************** now *******************/
+/* returns a monotonic timestamp in nanoseconds */
+static int64_t
+now()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
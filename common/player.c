@@ -8,18 +8,28 @@
 #include <stdio.h>
 #include <ctype.h>
 #include <string.h>
+#include "player.h"
 #include "message.h"
 #include "grid.h"
+#include "bitset.h"
+#include "mem.h"
 
 const char DEFAULTCHAR = '?';
 
 typedef struct player {
   char* name;           // name provided by client
   grid_t* vision;       // map of user vision
+  uint64_t* visible;    // bitset of tiles currently visible
+  uint64_t* seen;       // bitset of tiles ever seen
+  uint64_t* scratch;    // bitset the next update is computed into
+  bool visionStale;     // true if pos changed since the last vision update
   addr_t address;       // address of player
   char charID;          // character representation in game
   int pos;              // index position in the map string
   int gold;             // amount of gold held by player
+  int slot;             // index in its game's roster, -1 if in no game
+  deltastate_t* delta;  // frames of a client sent deltas, NULL if none
+  mem_arena_t* arena;   // holds the player's memory, NULL if malloc'd
 } player_t;
 
 /**** getter functions ***************************************/
@@ -30,6 +40,18 @@ player_getVision(player_t* player)
   return player ? player->vision : NULL;
 }
 
+uint64_t*
+player_getVisible(player_t* player)
+{
+  return player ? player->visible : NULL;
+}
+
+uint64_t*
+player_getSeen(player_t* player)
+{
+  return player ? player->seen : NULL;
+}
+
 char* 
 player_getName(player_t* player)
 {
@@ -60,6 +82,18 @@ player_getAddr(player_t* player)
   return player->address;
 }
 
+int
+player_getSlot(player_t* player)
+{
+  return player ? player->slot : -1;
+}
+
+deltastate_t*
+player_getDelta(player_t* player)
+{
+  return player ? player->delta : NULL;
+}
+
 /***** setter functions **************************************/
 
 grid_t* 
@@ -75,9 +109,14 @@ player_setVision(player_t* player, grid_t* vision)
 int 
 player_setPos(player_t* player, int pos)
 {
-  if ( player == NULL || pos < 0 ) {
+  // -1 takes the player off the map
+  if ( player == NULL || pos < -1 ) {
     return -1;
   }
+  // a new position means the field of view must be recomputed
+  if ( player->pos != pos ) {
+    player->visionStale = true;
+  }
   player->pos = pos;
   return player->pos;
 }
@@ -99,6 +138,29 @@ player_setAddr(player_t* player, addr_t address)
   return player->address;
 }
 
+int
+player_setSlot(player_t* player, int slot)
+{
+  if ( player == NULL ) {
+    return -1;
+  }
+  player->slot = slot;
+  return player->slot;
+}
+
+deltastate_t*
+player_setDelta(player_t* player, deltastate_t* delta)
+{
+  if ( player == NULL ) {
+    return NULL;
+  }
+  if ( player->delta != delta ) {
+    delta_delete(player->delta);
+  }
+  player->delta = delta;
+  return player->delta;
+}
+
 char
 player_setCharID(player_t* player, char newChar)
 {
@@ -114,29 +176,48 @@ player_setCharID(player_t* player, char newChar)
 /***** player_new ********************************************/
 /* see player.h for details */ 
 player_t* 
-player_new(char* name, char* mapfile)
+player_new(char* name, char* mapfile, mem_arena_t* arena)
 {
   // check params
-  if (name == NULL || mapfile == NULL) {
+  if (name == NULL) {
     return NULL;
   }
   
-  player_t* player = malloc(sizeof(player_t));
+  player_t* player = mem_arena_calloc(arena, 1, sizeof(player_t));
 
   // handle malloc error, return NULL if failure to allocate
   if ( player == NULL ) { 
     return NULL;
   } 
+  player->arena = arena;
 
   // save a copy of the name string in memory and handle malloc failure
-  if ((player->name = malloc(strlen(name) + 1)) == NULL) {
+  if ((player->name = mem_arena_alloc(arena, strlen(name) + 1)) == NULL) {
+    mem_arena_free(arena, player);
     return NULL;
   }
   // copy param string into player struct
   strcpy(player->name, name);
 
-  // the mapfile is verified by the server before ever being passed here
-  grid_t* vision = grid_new(mapfile);
+  // initialize all other values address to defaults
+  player->pos = -1;
+  player->visionStale = true;
+  player->gold = 0;
+  player->charID = DEFAULTCHAR;
+  player->address = message_noAddr();
+  player->slot = -1;
+
+  // without a map (as in the client) the player has no vision to track
+  if (mapfile == NULL) {
+    return player;
+  }
+
+  // the map is only read from disk the first time, see grid_new
+  grid_t* vision = grid_new(mapfile, arena);
+  if (vision == NULL) {
+    player_delete(player);
+    return NULL;
+  }
 
   // initialize values of active vision to be white space
   char* active = grid_getActive(vision);
@@ -148,12 +229,18 @@ player_new(char* name, char* mapfile)
     }
   }
 
-  // initialize all other values address to defaults and return
+  // vision bitsets start empty, nothing has been seen yet
+  size_t words = grid_getVisionWords(vision);
+  player->visible = mem_arena_calloc(arena, words, sizeof(uint64_t));
+  player->seen = mem_arena_calloc(arena, words, sizeof(uint64_t));
+  player->scratch = mem_arena_calloc(arena, words, sizeof(uint64_t));
+  if (player->visible == NULL || player->seen == NULL || player->scratch == NULL) {
+    player->vision = vision;
+    player_delete(player);
+    return NULL;
+  }
+
   player->vision = vision;
-  player->pos = -1;
-  player->gold = 0;
-  player->charID = DEFAULTCHAR;
-  player->address = message_noAddr();
   return player;
 }
 
@@ -207,10 +294,10 @@ char* player_summarize(player_t* player)
 /***** player_updateVision ***********************************/
 /* see player.h for full details */
 void
-player_updateVision(player_t* player, grid_t* grid)
+player_updateVision(player_t* player, grid_t* grid, viscache_t* cache)
 {
   // check parameters
-  if( player == NULL || grid == NULL ){
+  if( player == NULL || grid == NULL || player->vision == NULL ){
     return;
   }
   
@@ -219,42 +306,89 @@ player_updateVision(player_t* player, grid_t* grid)
     return;
   }
 
-  // initialize the vision array
   size_t mapLen = grid_getMapLen(grid);
-  int vision[mapLen + 1];
-  //int rowLen = grid_getNumColumns(grid);
-
-  for(int i = 0; i < mapLen + 1; i++){
-    vision[i] = 0;
-  }
-
-  // populate vision array
-  grid_calculateVision(grid, pos, vision);
+  size_t words = grid_getVisionWords(grid);
   
   // grabbing necessary map copies
   grid_t* currPlayerVision = player_getVision(player);
-
   char* globalActive = grid_getActive(grid);
-  char* playerActive = grid_getActive(currPlayerVision);
 
   if ( globalActive == NULL ) {
     return;
   }
 
+  // compute what is visible from the current position into the scratch bitset
+  uint64_t* visible = player->scratch;
+  bitset_clear(visible, words);
+
+  // use the grid's precomputed visibility table when it has one
+  const int* runs;
+  int numRuns = grid_lookupVisibility(grid, pos, &runs);
+  if( numRuns > 0 ){
+    for(int r = 0; r < numRuns; r++){
+      bitset_setRange(visible, runs[2 * r], runs[2 * r + 1]);
+    }
+  } else if( ! viscache_lookup(cache, pos, visible) ){
+    // otherwise calculate vision from scratch, unless someone stood here recently
+    grid_calculateVision(grid, pos, visible);
+    viscache_insert(cache, pos, visible);
+  }
+
   // updating PAST player vision to reference map values
+  // the previous visible set now holds only the tiles that left view
+  bitset_subtract(player->visible, visible, words);
+  for(int i = bitset_next(player->visible, words, 0); i >= 0 && i < mapLen; 
+      i = bitset_next(player->visible, words, i + 1)){
+    grid_revertTile(currPlayerVision, i);
+  }
+
   // then setting current vision to active map values
-  for(int i = 0; i < mapLen; i++){
-    if( isblank(playerActive[i]) == 0 ){ // is slot is not whitespace, revert it to its reference map tile
-      grid_revertTile(currPlayerVision, i);
-    } 
-    // check if the corresponding value in vision has a value of 1, in which case we use the active map value for this position
-    if( vision[i] == 1 ){
-      char newChar =  globalActive[i];
-      grid_replace(currPlayerVision, i, newChar);
-    }
+  for(int i = bitset_next(visible, words, 0); i >= 0 && i < mapLen; 
+      i = bitset_next(visible, words, i + 1)){
+    grid_replace(currPlayerVision, i, globalActive[i]);
   }
 
-  return;
+  // remember everything seen, and keep this update's set for the next one
+  bitset_union(player->seen, visible, words);
+  player->scratch = player->visible;
+  player->visible = visible;
+  player->visionStale = false;
+}
+
+/***** player_refreshVision **********************************/
+/* see player.h for full details */
+bool
+player_refreshVision(player_t* player, grid_t* grid, const uint64_t* dirty,
+                     viscache_t* cache)
+{
+  // check parameters
+  if( player == NULL || grid == NULL || dirty == NULL || player->vision == NULL ){
+    return false;
+  }
+
+  // players who moved need their whole field of view recomputed
+  if( player->visionStale ){
+    player_updateVision(player, grid, cache);
+    return true;
+  }
+
+  // skip players who can't see any of the changes
+  size_t words = grid_getVisionWords(grid);
+  if( ! bitset_intersects(player->visible, dirty, words) ){
+    return false;
+  }
+
+  // copy just the changed tiles in view, a word at a time
+  char* globalActive = grid_getActive(grid);
+  for(size_t w = 0; w < words; w++){
+    uint64_t changed = player->visible[w] & dirty[w];
+    while( changed != 0 ){
+      int i = (int)(w * 64) + __builtin_ctzll(changed);
+      grid_replace(player->vision, i, globalActive[i]);
+      changed &= changed - 1;
+    }
+  }
+  return true;
 }
 
 /***** player_delete *****************************************/
@@ -267,14 +401,18 @@ player_delete(player_t* player)
     return;
   }
   // free internal grid/string if not null (prevent invalid free)
+  // the vision grid is always deleted, to release the map it shares
   if (player->vision != NULL) {
     grid_delete(player->vision);
   }
-  if (player->name != NULL) {
-    free(player->name);
-  }
+  delta_delete(player->delta);
+  // the rest is only freed here if it didn't come from an arena
+  mem_arena_free(player->arena, player->name);
+  mem_arena_free(player->arena, player->visible);
+  mem_arena_free(player->arena, player->seen);
+  mem_arena_free(player->arena, player->scratch);
   // finally free player 
-  free(player);
+  mem_arena_free(player->arena, player);
 }
 
 /***** unit testing ******************************************/
@@ -300,7 +438,7 @@ main(const int argc, char* argv[])
 
   // make grid
   fprintf(stdout, "Creating grid... ");
-  grid_t* grid = grid_new(mapFile);
+  grid_t* grid = grid_new(mapFile, NULL);
   
   if( grid != NULL ){
     fprintf(stdout, "success\n");
@@ -311,7 +449,7 @@ main(const int argc, char* argv[])
   
   // creating a new player
   fprintf(stdout, "Creating new player... ");
-  player_t* player = player_new(name, mapFile);
+  player_t* player = player_new(name, mapFile, NULL);
 
   if( player != NULL ){
     fprintf(stdout, "success!\n");
@@ -337,6 +475,13 @@ main(const int argc, char* argv[])
   int position = player_setPos(player, 1394);
   fprintf(stdout, " set to %d\n", position);
   fprintf(stdout, "Getting player pos... got %d\n", player_getPos(player));
+  fprintf(stdout, "Setting player pos to -2... got %d\n", player_setPos(player, -2));
+  fprintf(stdout, "Getting player pos... got %d\n", player_getPos(player));
+  fprintf(stdout, "Taking player off the map (pos -1)... ");
+  position = player_setPos(player, -1);
+  fprintf(stdout, " set to %d\n", position);
+  fprintf(stdout, "Getting player pos... got %d\n", player_getPos(player));
+  player_setPos(player, 1394);
 
   // testing summarize
   player_setCharID(player, 'A');
@@ -344,7 +489,7 @@ main(const int argc, char* argv[])
   fprintf(stdout, "Player summary: %s\n", summary);
 
   // testing vision 
-  player_updateVision(player, grid);
+  player_updateVision(player, grid, NULL);
   grid_t* vision = player_getVision(player);
 
   if( vision == NULL ){
@@ -361,6 +506,8 @@ main(const int argc, char* argv[])
 
   // valgrind will show if there is mem issue
   player_delete(player);
+  grid_delete(grid);
+  grid_clearMapCache();
   exit(0);
 }
 
@@ -11,7 +11,10 @@
 #ifndef __PLAYER_H
 #define __PLAYER_H
 
+#include <stdint.h>
 #include "grid.h"
+#include "viscache.h"
+#include "delta.h"
 #include "message.h"
 
 /***** global types ******************************************/
@@ -24,6 +27,12 @@ typedef struct player player_t; // opaque to users of the module
 /* returns the value of various player attributes, or NULL/0 where applicable */
 
 grid_t* player_getVision(player_t* player);
+
+/* bitsets (see bitset.h) of the tiles the player can currently see,
+ * and of every tile they have ever seen, as of the last player_updateVision
+ */
+uint64_t* player_getVisible(player_t* player);
+uint64_t* player_getSeen(player_t* player);
 char* player_getName(player_t* player);
 char player_getCharID(player_t* player);
 
@@ -36,28 +45,47 @@ int player_getGold(player_t* player);
 /* NOTE: This DOES NOT check for NULL within func. Only use on non-null players */
 addr_t player_getAddr(player_t* player);
 
+/* the game a player joins keeps copies of their position, gold, charID and address
+ * in arrays indexed by this slot (see game.h); -1 until they join a game
+ */
+int player_getSlot(player_t* player);
+
+/* frames sent to, or received by, a client that asked for DELTA messages
+ * (see delta.h); NULL for a client sent whole DISPLAY messages
+ */
+deltastate_t* player_getDelta(player_t* player);
+
 /***** setters ***********************************************/
 /* set the value of various attributes of a player struct and return their value */
 
 grid_t* player_setVision(player_t* player, grid_t* vision);
 char player_setCharID(player_t* player, char newChar);
-int player_setPos(player_t* player, int pos);
+int player_setPos(player_t* player, int pos);   // pos -1 is off the map
 int player_setGold(player_t* player, int gold);
 addr_t player_setAddr(player_t* player, addr_t address);
+int player_setSlot(player_t* player, int slot);
+
+/* the player keeps the given state, which may be NULL,
+ * and deletes the one they had, if any
+ */
+deltastate_t* player_setDelta(player_t* player, deltastate_t* delta);
 
 /***** player_new ********************************************/
 /* Initalized a new 'player' struct
  * takes a string as parameter, wherein the string refers to a player name
  * also takes a mapfile string as a parameter
- * which is then used to generate the initial vision grid
+ * which is then used to generate the initial vision grid (see grid_new)
+ * mapfile may be NULL for a player with no vision, such as the client's own player
  * allocates memory for the player struct which must be free'd by calling player_delete
+ * the player and their vision grid are allocated from the given arena (see mem.h),
+ * or with malloc if it is NULL; the arena must outlive the player
  * Stores a copy of the name string, allowing the original name to be free'd
  * initializes other attributes of the player to NULL where applicable, 
  * 0 for gold, and -1 for position
  *
  * returns player_t* if successful, otherwise NULL
  */
-player_t* player_new(char* name, char* mapfile);
+player_t* player_new(char* name, char* mapfile, mem_arena_t* arena);
 
 /***** player_addGold ****************************************/
 /* Add the provided number of gold to a player's inventory
@@ -71,9 +99,25 @@ int player_addGold(player_t* player, int newGold);
 /* Updates a player's vision to that of a given position
  * Takes a point to a player struct, a pointer to a grid struct, and a position integer
  * where, in game, the grid is the server's grid
+ * uses the grid's visibility table when grid_buildVisibility has been called,
+ * otherwise looks in the given cache (which may be NULL) for the player's position,
+ * and on a miss calculates the vision with grid_calculateVision and caches it
  * Returns void
  */
-void player_updateVision(player_t* player, grid_t* grid);
+void player_updateVision(player_t* player, grid_t* grid, viscache_t* cache);
+
+/***** player_refreshVision **********************************/
+/* Brings a player's vision up to date after changes to the given grid
+ * where 'dirty' is the bitset of active map positions that changed (see grid_getDirty)
+ * if the player's position changed since their last update, their field of view
+ * is recomputed with player_updateVision, using the given cache
+ * otherwise only the changed tiles the player can currently see are copied,
+ * and players who can see none of the changed tiles are left untouched
+ * Returns true if the player's vision grid was updated (and should be resent)
+ * false if nothing the player can see has changed
+ */
+bool player_refreshVision(player_t* player, grid_t* grid, const uint64_t* dirty,
+                          viscache_t* cache);
 
 /***** player_summarize **************************************/
 /* creates a summary of the player for printing when the game ends
@@ -0,0 +1,196 @@
+/*
+ * This file implements the "viscache" module for our nuggets game
+ * The "viscache" module is defined in viscache.h
+ *
+ * Entries live in one array and are linked into a doubly linked list
+ * in order of use; a position-indexed array finds an entry in O(1)
+ * A mutex guards the whole cache, held only while copying a set in or out
+ *
+ * Winter 2022, CS50 team 1
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <pthread.h>
+#include "viscache.h"
+#include "mem.h"
+
+/**************** local types ****************/
+typedef struct entry {
+  int pos;                             // position this set was computed from
+  int prev;                            // more recently used entry, -1 if none
+  int next;                            // less recently used entry, -1 if none
+} entry_t;
+
+/**************** global types ****************/
+typedef struct viscache {
+  int capacity;                        // number of entries
+  int used;                            // entries holding a set
+  size_t mapLen;                       // number of positions in the map
+  size_t words;                        // words per visible set
+  entry_t* entries;                    // capacity entries
+  uint64_t* sets;                      // capacity * words, one set per entry
+  int* slotOf;                         // entry holding each position, -1 if none
+  int head;                            // most recently used entry, -1 if empty
+  int tail;                            // least recently used entry, -1 if empty
+  unsigned long hits;                  // lookups that found their position
+  unsigned long misses;                // lookups that did not
+  pthread_mutex_t lock;                // protects everything above
+} viscache_t;
+
+/**************** local functions ****************/
+static void unlinkEntry(viscache_t* cache, int slot);
+static void pushFront(viscache_t* cache, int slot);
+
+/**************** viscache_new ****************/
+/* see header file for details */
+viscache_t* viscache_new(int capacity, size_t mapLen, size_t words)
+{
+  if (capacity <= 0 || mapLen == 0 || words == 0) {
+    return NULL;
+  }
+
+  viscache_t* cache = mem_calloc(1, sizeof(viscache_t));
+  if (cache == NULL) {
+    return NULL;
+  }
+  cache->capacity = capacity;
+  cache->mapLen = mapLen;
+  cache->words = words;
+  cache->head = cache->tail = -1;
+  pthread_mutex_init(&cache->lock, NULL);
+
+  if ((cache->entries = mem_calloc(capacity, sizeof(entry_t))) == NULL
+      || (cache->sets = mem_calloc(capacity * words, sizeof(uint64_t))) == NULL
+      || (cache->slotOf = mem_malloc(mapLen * sizeof(int))) == NULL) {
+    viscache_delete(cache);
+    return NULL;
+  }
+  for (size_t i = 0; i < mapLen; i++) {
+    cache->slotOf[i] = -1;
+  }
+  return cache;
+}
+
+/**************** viscache_lookup ****************/
+/* see header file for details */
+bool viscache_lookup(viscache_t* cache, int pos, uint64_t* vision)
+{
+  if (cache == NULL || vision == NULL || pos < 0 || pos >= cache->mapLen) {
+    return false;
+  }
+
+  pthread_mutex_lock(&cache->lock);
+  int slot = cache->slotOf[pos];
+  if (slot < 0) {
+    cache->misses++;
+    pthread_mutex_unlock(&cache->lock);
+    return false;
+  }
+  cache->hits++;
+  memcpy(vision, &cache->sets[slot * cache->words], cache->words * sizeof(uint64_t));
+  unlinkEntry(cache, slot);
+  pushFront(cache, slot);
+  pthread_mutex_unlock(&cache->lock);
+  return true;
+}
+
+/**************** viscache_insert ****************/
+/* see header file for details */
+void viscache_insert(viscache_t* cache, int pos, const uint64_t* vision)
+{
+  if (cache == NULL || vision == NULL || pos < 0 || pos >= cache->mapLen) {
+    return;
+  }
+
+  pthread_mutex_lock(&cache->lock);
+  int slot = cache->slotOf[pos];
+  if (slot >= 0) {
+    // another thread got here first, just refresh it
+    unlinkEntry(cache, slot);
+  } else if (cache->used < cache->capacity) {
+    // take a fresh entry
+    slot = cache->used++;
+  } else {
+    // reuse the least recently used entry
+    slot = cache->tail;
+    unlinkEntry(cache, slot);
+    cache->slotOf[cache->entries[slot].pos] = -1;
+  }
+
+  cache->entries[slot].pos = pos;
+  cache->slotOf[pos] = slot;
+  memcpy(&cache->sets[slot * cache->words], vision, cache->words * sizeof(uint64_t));
+  pushFront(cache, slot);
+  pthread_mutex_unlock(&cache->lock);
+}
+
+/**************** getters ****************/
+/* see header file for details */
+unsigned long viscache_getHits(viscache_t* cache)
+{
+  return cache ? cache->hits : 0;
+}
+
+unsigned long viscache_getMisses(viscache_t* cache)
+{
+  return cache ? cache->misses : 0;
+}
+
+int viscache_getCapacity(viscache_t* cache)
+{
+  return cache ? cache->capacity : 0;
+}
+
+/**************** viscache_delete ****************/
+/* see header file for details */
+void viscache_delete(viscache_t* cache)
+{
+  if (cache == NULL) {
+    return;
+  }
+  if (cache->entries != NULL) {
+    mem_free(cache->entries);
+  }
+  if (cache->sets != NULL) {
+    mem_free(cache->sets);
+  }
+  if (cache->slotOf != NULL) {
+    mem_free(cache->slotOf);
+  }
+  pthread_mutex_destroy(&cache->lock);
+  mem_free(cache);
+}
+
+/**************** unlinkEntry ****************/
+/* removes the given entry from the usage list */
+static void unlinkEntry(viscache_t* cache, int slot)
+{
+  entry_t* entry = &cache->entries[slot];
+  if (entry->prev >= 0) {
+    cache->entries[entry->prev].next = entry->next;
+  } else {
+    cache->head = entry->next;
+  }
+  if (entry->next >= 0) {
+    cache->entries[entry->next].prev = entry->prev;
+  } else {
+    cache->tail = entry->prev;
+  }
+}
+
+/**************** pushFront ****************/
+/* makes the given (unlinked) entry the most recently used */
+static void pushFront(viscache_t* cache, int slot)
+{
+  entry_t* entry = &cache->entries[slot];
+  entry->prev = -1;
+  entry->next = cache->head;
+  if (cache->head >= 0) {
+    cache->entries[cache->head].prev = slot;
+  } else {
+    cache->tail = slot;
+  }
+  cache->head = slot;
+}
@@ -0,0 +1,61 @@
+/*
+ * This file defines the "viscache" module for our nuggets game
+ * A viscache remembers the visible sets most recently computed by
+ * grid_calculateVision, keyed by map position, so that players who stand
+ * where someone has stood before don't recompute the same field of view
+ *
+ * When the cache is full the least recently used position is dropped
+ * A cache may be shared by threads updating different players' vision
+ *
+ * Winter 2022, CS50 team 1
+ */
+
+#ifndef __VISCACHE_H
+#define __VISCACHE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/**************** global types ****************/
+typedef struct viscache viscache_t;  // opaque to users of the module
+
+/**************** functions **************/
+
+/**************** viscache_new ****************/
+/* creates an empty cache holding up to 'capacity' visible sets 
+ * for a map of 'mapLen' positions, each set being 'words' 64-bit words long
+ * (see grid_getMapLen and grid_getVisionWords)
+ * returns NULL if any parameter is not positive or memory can't be allocated
+ * caller is responsible for calling viscache_delete
+ */
+viscache_t* viscache_new(int capacity, size_t mapLen, size_t words);
+
+/**************** viscache_lookup ****************/
+/* copies the cached visible set for the given position into 'vision'
+ * and marks it as the most recently used
+ * returns true on a hit, false if the position is not cached
+ * (or on bad parameters), in which case 'vision' is left untouched
+ */
+bool viscache_lookup(viscache_t* cache, int pos, uint64_t* vision);
+
+/**************** viscache_insert ****************/
+/* stores a copy of the visible set for the given position,
+ * dropping the least recently used set if the cache is full
+ * replaces the stored set if the position is already cached
+ */
+void viscache_insert(viscache_t* cache, int pos, const uint64_t* vision);
+
+/**************** getters **************/
+/* number of lookups that found, or did not find, their position
+ * both are 0 if cache is NULL
+ */
+unsigned long viscache_getHits(viscache_t* cache);
+unsigned long viscache_getMisses(viscache_t* cache);
+int viscache_getCapacity(viscache_t* cache);
+
+/**************** viscache_delete ****************/
+/* frees the cache and every set in it, does nothing if NULL */
+void viscache_delete(viscache_t* cache);
+
+#endif
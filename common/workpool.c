@@ -0,0 +1,224 @@
+/*
+ * This file implements the "workpool" module for our nuggets game
+ * The "workpool" module is defined in workpool.h
+ *
+ * Tasks are handed out one index at a time from a shared counter,
+ * so a slow task does not hold up the others
+ *
+ * Winter 2022, CS50 team 1
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdbool.h>
+#include <pthread.h>
+#include "workpool.h"
+#include "mem.h"
+
+/**************** global types ****************/
+typedef struct workpool {
+  pthread_t* threads;                  // helper threads
+  int numHelpers;                      // number of helper threads started
+  pthread_mutex_t lock;                // protects everything below
+  pthread_cond_t workReady;            // signalled when a batch starts or on shutdown
+  pthread_cond_t workDone;             // signalled when the last task finishes
+  void (*task)(void* arg, int index);  // task of the current batch, NULL if none
+  void* arg;                           // argument for the current batch
+  int count;                           // number of tasks in the current batch
+  int next;                            // next index to hand out
+  int remaining;                       // tasks not yet finished
+  bool shutdown;                       // true when helpers should exit
+} workpool_t;
+
+/**************** local functions ****************/
+static void* workerMain(void* arg);
+static void runTasks(workpool_t* pool);
+
+/**************** workpool_new ****************/
+/* see header file for details */
+workpool_t* workpool_new(int numThreads)
+{
+  workpool_t* pool = mem_calloc(1, sizeof(workpool_t));
+  if (pool == NULL) {
+    return NULL;
+  }
+
+  pthread_mutex_init(&pool->lock, NULL);
+  pthread_cond_init(&pool->workReady, NULL);
+  pthread_cond_init(&pool->workDone, NULL);
+
+  // the caller of workpool_run does its share, so start one fewer thread
+  int helpers = numThreads > 1 ? numThreads - 1 : 0;
+  if (helpers > 0) {
+    if ((pool->threads = mem_calloc(helpers, sizeof(pthread_t))) == NULL) {
+      workpool_delete(pool);
+      return NULL;
+    }
+    for (int i = 0; i < helpers; i++) {
+      if (pthread_create(&pool->threads[i], NULL, workerMain, pool) != 0) {
+        workpool_delete(pool);
+        return NULL;
+      }
+      pool->numHelpers++;
+    }
+  }
+  return pool;
+}
+
+/**************** workpool_getNumThreads ****************/
+/* see header file for details */
+int workpool_getNumThreads(workpool_t* pool)
+{
+  return pool ? pool->numHelpers + 1 : 0;
+}
+
+/**************** workpool_run ****************/
+/* see header file for details */
+void workpool_run(workpool_t* pool, void (*task)(void* arg, int index), 
+                  void* arg, int count)
+{
+  if (task == NULL || count <= 0) {
+    return;
+  }
+
+  // no helpers to hand work to, just run everything here
+  if (pool == NULL || pool->numHelpers == 0) {
+    for (int i = 0; i < count; i++) {
+      (*task)(arg, i);
+    }
+    return;
+  }
+
+  // publish the batch and wake the helpers
+  pthread_mutex_lock(&pool->lock);
+  pool->task = task;
+  pool->arg = arg;
+  pool->count = count;
+  pool->next = 0;
+  pool->remaining = count;
+  pthread_cond_broadcast(&pool->workReady);
+
+  // work alongside the helpers, then wait for the stragglers
+  runTasks(pool);
+  while (pool->remaining > 0) {
+    pthread_cond_wait(&pool->workDone, &pool->lock);
+  }
+  pool->task = NULL;
+  pthread_mutex_unlock(&pool->lock);
+}
+
+/**************** workpool_delete ****************/
+/* see header file for details */
+void workpool_delete(workpool_t* pool)
+{
+  if (pool == NULL) {
+    return;
+  }
+
+  // tell helpers to exit and wait for them
+  pthread_mutex_lock(&pool->lock);
+  pool->shutdown = true;
+  pthread_cond_broadcast(&pool->workReady);
+  pthread_mutex_unlock(&pool->lock);
+  for (int i = 0; i < pool->numHelpers; i++) {
+    pthread_join(pool->threads[i], NULL);
+  }
+
+  pthread_cond_destroy(&pool->workDone);
+  pthread_cond_destroy(&pool->workReady);
+  pthread_mutex_destroy(&pool->lock);
+  if (pool->threads != NULL) {
+    mem_free(pool->threads);
+  }
+  mem_free(pool);
+}
+
+/**************** workerMain ****************/
+/* body of each helper thread
+ * sleeps until a batch is published, helps run it, and repeats until shutdown
+ */
+static void* workerMain(void* arg)
+{
+  workpool_t* pool = arg;
+
+  pthread_mutex_lock(&pool->lock);
+  while (true) {
+    while ( ! pool->shutdown && (pool->task == NULL || pool->next >= pool->count)) {
+      pthread_cond_wait(&pool->workReady, &pool->lock);
+    }
+    if (pool->shutdown) {
+      break;
+    }
+    runTasks(pool);
+  }
+  pthread_mutex_unlock(&pool->lock);
+  return NULL;
+}
+
+/**************** runTasks ****************/
+/* claims and runs tasks from the current batch until none are left to claim
+ * called and returns with the pool's lock held; the lock is released while a task runs
+ */
+static void runTasks(workpool_t* pool)
+{
+  while (pool->task != NULL && pool->next < pool->count) {
+    int index = pool->next++;
+    void (*task)(void* arg, int index) = pool->task;
+    void* arg = pool->arg;
+
+    pthread_mutex_unlock(&pool->lock);
+    (*task)(arg, index);
+    pthread_mutex_lock(&pool->lock);
+
+    // the caller of workpool_run is waiting on the last task of the batch
+    if (--pool->remaining == 0) {
+      pthread_cond_signal(&pool->workDone);
+    }
+  }
+}
+
+/* ********************************************************** */
+/* a simple unit test of the code above */
+#ifdef WORKPOOLTEST
+
+/* adds its index into its own slot of the array passed as arg */
+static void fillTask(void* arg, int index)
+{
+  long* slots = arg;
+  slots[index] += index;
+}
+
+int main(const int argc, char* argv[])
+{
+  const int count = 10000;             // tasks per batch
+  const int batches = 50;              // batches run through the pool
+  long slots[count];                   // one slot per task
+
+  for (int threads = 0; threads <= 8; threads += 4) {
+    workpool_t* pool = workpool_new(threads);
+    if (pool == NULL) {
+      fprintf(stderr, "workpool creation failure\n");
+      exit(1);
+    }
+
+    for (int i = 0; i < count; i++) {
+      slots[i] = 0;
+    }
+    for (int b = 0; b < batches; b++) {
+      workpool_run(pool, fillTask, slots, count);
+    }
+
+    // every task must have run exactly once per batch
+    int wrong = 0;
+    for (int i = 0; i < count; i++) {
+      if (slots[i] != (long)i * batches) {
+        wrong++;
+      }
+    }
+    printf("%d threads: %d of %d slots wrong\n", 
+           workpool_getNumThreads(pool), wrong, count);
+    workpool_delete(pool);
+  }
+  exit(0);
+}
+#endif
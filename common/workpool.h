@@ -0,0 +1,49 @@
+/*
+ * This file defines the "workpool" module for our nuggets game
+ * A workpool is a fixed-size set of worker threads that runs a batch of
+ * independent tasks in parallel, then waits for all of them to finish
+ *
+ * The server uses it to compute every player's vision and DISPLAY frame
+ * at the same time; tasks must only write state that belongs to their own index
+ *
+ * Winter 2022, CS50 team 1
+ */
+
+#ifndef __WORKPOOL_H
+#define __WORKPOOL_H
+
+/**************** global types ****************/
+typedef struct workpool workpool_t;  // opaque to users of the module
+
+/**************** functions **************/
+
+/**************** workpool_new ****************/
+/* creates a pool that runs tasks on the given number of threads in total
+ * the thread calling workpool_run counts as one of them,
+ * so numThreads - 1 helper threads are started here
+ * a pool with numThreads <= 1 starts no threads and runs every task in the caller
+ * returns NULL if memory can't be allocated or threads can't be started
+ * caller is responsible for calling workpool_delete
+ */
+workpool_t* workpool_new(int numThreads);
+
+/**************** workpool_getNumThreads ****************/
+/* returns the number of threads tasks are spread across, 0 if pool is NULL */
+int workpool_getNumThreads(workpool_t* pool);
+
+/**************** workpool_run ****************/
+/* calls task(arg, i) once for every i in [0, count), spread across the pool
+ * does not return until every task has finished
+ * tasks may run in any order and at the same time as each other
+ * if pool is NULL, runs every task in the caller
+ */
+void workpool_run(workpool_t* pool, void (*task)(void* arg, int index), 
+                  void* arg, int count);
+
+/**************** workpool_delete ****************/
+/* stops and joins the pool's threads, then frees the pool
+ * must not be called while workpool_run is in progress
+ */
+void workpool_delete(workpool_t* pool);
+
+#endif
@@ -8,18 +8,50 @@
  * 2. Variants that 'assert' the result is non-NULL;
  *    if NULL occurs, kick out an error and die.
  *
+ * 3. Arenas, which hand out space from a few large blocks
+ *    and release all of it at once.
+ *
  * David Kotz, April 2016, 2017, 2019, 2021
  */
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
 #include "mem.h"
 
+/**************** file-local types ****************/
+/* one block of an arena; its space follows the header */
+typedef struct arenablock {
+  struct arenablock* next;      // block allocated before this one
+  size_t size;                  // bytes of space in the block
+  size_t used;                  // bytes handed out so far
+  max_align_t space[];          // the space itself, aligned as malloc's
+} arenablock_t;
+
+/* an arena, allocating from its newest ordinary block */
+struct mem_arena {
+  arenablock_t* head;           // block currently allocated from, or NULL
+  size_t blockSize;             // size of ordinary blocks
+  size_t total;                 // bytes of space in all blocks
+  void* last;                   // most recent allocation from head, or NULL
+};
+
+/**************** file-local constants ****************/
+static const size_t ARENA_BLOCKSIZE = 64 * 1024;  // default block size
+static const size_t ARENA_ALIGN = _Alignof(max_align_t); // alignment of all space
+
+/**************** file-local functions ****************/
+static size_t arenaRound(const size_t size);
+static arenablock_t* arenaBlock(const size_t size);
+
 /**************** file-local global variables ****************/
-// track malloc and free across *all* calls within this program.
-static int nmalloc = 0;         // number of successful malloc calls
-static int nfree = 0;           // number of free calls
-static int nfreenull = 0;       // number of free(NULL) calls
+// track malloc and free across *all* calls within this program,
+// made from any thread, so the counts are atomic
+static _Atomic int nmalloc = 0; // number of successful malloc calls
+static _Atomic int nfree = 0;   // number of free calls
+static _Atomic int nfreenull = 0; // number of free(NULL) calls
 
 
 /**************** mem_assert ****************/
@@ -125,3 +157,198 @@ mem_net(void)
 {
   return nmalloc - nfree - nfreenull;
 }
+
+/**************** mem_arena_new() ****************/
+/* see mem.h for description */
+mem_arena_t*
+mem_arena_new(const size_t blockSize)
+{
+  mem_arena_t* arena = mem_malloc(sizeof(mem_arena_t));
+  if (arena == NULL) {
+    return NULL;
+  }
+  // blocks are only allocated once something is asked for
+  arena->head = NULL;
+  arena->blockSize = blockSize > 0 ? arenaRound(blockSize) : ARENA_BLOCKSIZE;
+  arena->total = 0;
+  arena->last = NULL;
+  if (arena->blockSize == 0) {
+    mem_free(arena);
+    return NULL;
+  }
+  return arena;
+}
+
+/**************** mem_arena_alloc() ****************/
+/* see mem.h for description */
+void*
+mem_arena_alloc(mem_arena_t* arena, const size_t size)
+{
+  arenablock_t* block;          // block to allocate from
+  void* ptr;                    // space handed out
+
+  if (arena == NULL) {
+    return mem_malloc(size);
+  }
+  size_t need = arenaRound(size > 0 ? size : 1);
+  if (need == 0) {
+    return NULL;                // size too big to round up
+  }
+
+  block = arena->head;
+  if (block == NULL || block->size - block->used < need) {
+    if (need > arena->blockSize) {
+      // a big request gets a block of its own, behind the current one,
+      // so the rest of the current block is still used
+      if ((block = arenaBlock(need)) == NULL) {
+        return NULL;
+      }
+      block->used = need;
+      if (arena->head == NULL) {
+        arena->head = block;
+      } else {
+        block->next = arena->head->next;
+        arena->head->next = block;
+      }
+      arena->total += need;
+      return block->space;
+    }
+    // start a new block, abandoning what is left of the old one
+    if ((block = arenaBlock(arena->blockSize)) == NULL) {
+      return NULL;
+    }
+    block->next = arena->head;
+    arena->head = block;
+    arena->total += block->size;
+  }
+
+  ptr = (char*)block->space + block->used;
+  block->used += need;
+  arena->last = ptr;
+  return ptr;
+}
+
+/**************** mem_arena_calloc() ****************/
+/* see mem.h for description */
+void*
+mem_arena_calloc(mem_arena_t* arena, const size_t nmemb, const size_t size)
+{
+  if (arena == NULL) {
+    return mem_calloc(nmemb, size);
+  }
+  if (size > 0 && nmemb > SIZE_MAX / size) {
+    return NULL;
+  }
+  void* ptr = mem_arena_alloc(arena, nmemb * size);
+  if (ptr != NULL) {
+    memset(ptr, 0, nmemb * size);
+  }
+  return ptr;
+}
+
+/**************** mem_arena_realloc() ****************/
+/* see mem.h for description */
+void*
+mem_arena_realloc(mem_arena_t* arena, void* ptr, 
+                  const size_t oldSize, const size_t newSize)
+{
+  void* newPtr;                 // space to return
+
+  if (arena == NULL) {
+    newPtr = realloc(ptr, newSize);
+    if (newPtr != NULL && ptr == NULL) {
+      nmalloc++;
+    }
+    return newPtr;
+  }
+  if (ptr == NULL) {
+    return mem_arena_alloc(arena, newSize);
+  }
+
+  // the most recent allocation can just take more of its block
+  if (ptr == arena->last) {
+    arenablock_t* block = arena->head;
+    size_t start = (char*)ptr - (char*)block->space;
+    size_t need = arenaRound(newSize > 0 ? newSize : 1);
+    if (need != 0 && need <= block->size - start) {
+      block->used = start + need;
+      return ptr;
+    }
+  }
+  if (newSize <= oldSize) {
+    return ptr;
+  }
+
+  if ((newPtr = mem_arena_alloc(arena, newSize)) == NULL) {
+    return NULL;
+  }
+  memcpy(newPtr, ptr, oldSize);
+  return newPtr;
+}
+
+/**************** mem_arena_free() ****************/
+/* see mem.h for description */
+void
+mem_arena_free(mem_arena_t* arena, void* ptr)
+{
+  if (arena == NULL && ptr != NULL) {
+    mem_free(ptr);
+  }
+}
+
+/**************** mem_arena_size() ****************/
+/* see mem.h for description */
+size_t
+mem_arena_size(mem_arena_t* arena)
+{
+  return arena != NULL ? arena->total : 0;
+}
+
+/**************** mem_arena_delete() ****************/
+/* see mem.h for description */
+void
+mem_arena_delete(mem_arena_t* arena)
+{
+  if (arena == NULL) {
+    return;
+  }
+  arenablock_t* block = arena->head;
+  while (block != NULL) {
+    arenablock_t* next = block->next;
+    mem_free(block);
+    block = next;
+  }
+  mem_free(arena);
+}
+
+/**************** arenaRound() ****************/
+/* Round size up to a multiple of ARENA_ALIGN,
+ * returning 0 if the result would overflow.
+ */
+static size_t
+arenaRound(const size_t size)
+{
+  if (size > SIZE_MAX - (ARENA_ALIGN - 1)) {
+    return 0;
+  }
+  return (size + ARENA_ALIGN - 1) & ~(ARENA_ALIGN - 1);
+}
+
+/**************** arenaBlock() ****************/
+/* Allocate an empty block with the given bytes of space, or return NULL.
+ */
+static arenablock_t*
+arenaBlock(const size_t size)
+{
+  if (size > SIZE_MAX - sizeof(arenablock_t)) {
+    return NULL;
+  }
+  arenablock_t* block = mem_malloc(sizeof(arenablock_t) + size);
+  if (block == NULL) {
+    return NULL;
+  }
+  block->next = NULL;
+  block->size = size;
+  block->used = 0;
+  return block;
+}
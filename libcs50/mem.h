@@ -14,6 +14,9 @@
  *    that needs to defensively check function parameters that
  *    "should never be NULL".
  *
+ * 4. Arenas: allocations carved out of a few large blocks,
+ *    which are all released at once by mem_arena_delete.
+ *
  * David Kotz, April 2016, 2017, 2019, 2021
  */
 
@@ -23,6 +26,9 @@
 #include <stdio.h>
 #include <stdlib.h>
 
+/**************** global types ****************/
+typedef struct mem_arena mem_arena_t;  // opaque to users of the module
+
 /**************** mem_assert **************************/
 /* If pointer p is NULL, print error message to stderr and die,
  * otherwise, return p unchanged.  Works nicely as a pass-through:
@@ -113,4 +119,65 @@ void mem_report(FILE* fp, const char* message);
  */
 int mem_net(void);
 
+/**************** mem_arena_new() ****************/
+/* Create an empty arena, which allocates memory in blocks of blockSize bytes.
+ * Caller provides:
+ *   the block size, or 0 for a default of 64 KiB.
+ * We return:
+ *   pointer to the new arena, or NULL if failure.
+ * Caller is responsible for later calling mem_arena_delete.
+ * An arena is not thread-safe; only one thread at a time may use it.
+ */
+mem_arena_t* mem_arena_new(const size_t blockSize);
+
+/**************** mem_arena_alloc() ****************/
+/* Like mem_malloc(), but allocate from the given arena.
+ * Caller provides:
+ *   an arena, or NULL to use mem_malloc(); and the size, as in malloc().
+ * We return:
+ *   pointer to allocated space, aligned as malloc() would, or NULL if failure.
+ * Requests bigger than the arena's block size get a block of their own.
+ */
+void* mem_arena_alloc(mem_arena_t* arena, const size_t size);
+
+/**************** mem_arena_calloc() ****************/
+/* Like mem_calloc(), but allocate from the given arena (or mem_calloc if NULL).
+ */
+void* mem_arena_calloc(mem_arena_t* arena, const size_t nmemb, const size_t size);
+
+/**************** mem_arena_realloc() ****************/
+/* Like realloc(), but for space from mem_arena_alloc on the same arena.
+ * Caller provides:
+ *   the arena (or NULL), the space (or NULL), its current size, and the new size.
+ * We return:
+ *   pointer to the resized space, or NULL if failure, in which case
+ *   the original space is untouched.
+ * The most recent allocation from an arena grows in place if there is room;
+ * otherwise the contents are copied, and the old space is only reclaimed
+ * when the arena is deleted.
+ */
+void* mem_arena_realloc(mem_arena_t* arena, void* ptr, 
+                        const size_t oldSize, const size_t newSize);
+
+/**************** mem_arena_free() ****************/
+/* Release space from mem_arena_alloc and friends.
+ * If arena is NULL, calls mem_free() on any non-NULL ptr;
+ * otherwise does nothing, as arena space is only released by mem_arena_delete.
+ * Lets code free what it allocated the same way, with or without an arena.
+ */
+void mem_arena_free(mem_arena_t* arena, void* ptr);
+
+/**************** mem_arena_size() ****************/
+/* Return the number of bytes the arena holds in its blocks,
+ * or 0 if arena is NULL.
+ */
+size_t mem_arena_size(mem_arena_t* arena);
+
+/**************** mem_arena_delete() ****************/
+/* Release every block of the arena, and the arena itself, in one call.
+ * All space allocated from the arena becomes invalid.
+ * Does nothing if arena is NULL.
+ */
+void mem_arena_delete(mem_arena_t* arena);
+
 #endif // __MEM_H
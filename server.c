@@ -4,12 +4,16 @@
  * CS50, Winter 2022, team 1
  */
 
+#define _GNU_SOURCE                    // pthread_setaffinity_np, random_r
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdbool.h>
 #include <string.h>
 #include <ctype.h>
 #include <unistd.h>
+#include <time.h>
+#include <pthread.h>
+#include <sched.h>
 #include "file.h"
 #include "grid.h"
 #include "mem.h"
@@ -17,6 +21,8 @@
 #include "player.h"
 #include "message.h"
 #include "log.h"
+#include "bitset.h"
+#include "workpool.h"
 
 // global constants
 static const int goldMaxNumPiles = 30; // maximum number of gold piles
@@ -26,42 +32,151 @@ static const char PASSAGETILE = '#';   // char representation of passage tile
 static const char GOLDTILE = '*';      // char representation of gold
 static const char PLAYERCHAR = '@';    // player's view of themself
 static const int MaxNameLength = 50;   // max number of chars in playerName
-static const int MaxPlayers = 26;      // maximum number of players (and spectator)
 static const int GoldTotal = 250;      // amount of gold in the game
-
-// global game state
-static game_t* game;
+static const double shardIdleTimeout = 0.1; // seconds between a finished shard's checks
+
+// games being hosted by this thread's shard, NULL where a slot is free
+static _Thread_local game_t** games = NULL;
+// most games hosted at once, set by the --games option
+static int maxGames = 1;
+// keep hosting new games as others end, instead of exiting after the first,
+// set by the --games option
+static bool multiGame = false;
+// map every game is played on
+static char* mapPathname = NULL;
+// seed of the first game; each later game is seeded with the next number
+static int firstSeed = 0;
+// games started so far by this thread's shard
+static _Thread_local int gamesStarted = 0;
+// this thread's shard, numbered from 0 (see runShards)
+static _Thread_local int shardIndex = 0;
+// true once this thread's shard has finished (see finishShard)
+static _Thread_local bool shardFinished = false;
+// this shard's random numbers, kept apart from other shards' (see nextRandom)
+static _Thread_local struct random_data randomData;
+static _Thread_local char randomState[128];
+// number of shards, each with its own socket, thread and games, set by --shards
+static int numShards = 1;
+// vision engine used by the server grid, set by the --vision option
+static visionmode_t visionMode = VISION_RAYCAST;
+// precompute visibility from every tile at startup, set by --vistable
+static bool useVisTable = true;
+// visible sets to keep in the shared vision cache, set by --viscache
+static int visCacheSize = 256;
+// number of threads updating vision, set by the --threads option
+static int numThreads = 1;
+// most players that may join (besides the spectator), set by --maxplayers
+static int maxPlayers = 26;
+// rate, in ticks per second, at which players' keys are applied, set by --tick;
+// 0 applies each key as it arrives
+static int tickRate = 0;
+// when this thread's shard is due to run its next tick, in seconds (see timeNow)
+static _Thread_local double nextTick = 0;
+// threads shared by every call to updatePlayersVision on this shard
+static _Thread_local workpool_t* visionPool = NULL;
+
+// vision update for one player, filled in by a worker thread
+typedef struct visionJob {
+  player_t* player;                    // player to update
+  int slot;                            // the player's slot in the roster
+  const char* frame;                   // DISPLAY message for the player
+  bool send;                           // true if frame should be sent
+} visionJob_t;
+
+// what updateHelper needs to know about the update it is part of
+typedef struct visionRound {
+  game_t* game;                        // game being updated
+  const uint64_t* dirty;               // tiles changed since the last update
+  visionJob_t* jobs;                   // the shard's jobs, one per index
+} visionRound_t;
+
+// one job per player who may need an update, reused across updates and games
+// of this thread's shard
+static _Thread_local visionJob_t* visionJobs = NULL;
+static _Thread_local int numVisionJobs = 0; // jobs in use by the current update
+static _Thread_local int maxVisionJobs = 0; // jobs allocated
+
+// a shard run on a thread of its own by runShards
+typedef struct shard {
+  int index;                           // shard number
+  int port;                            // port every shard listens on
+  pthread_t thread;                    // thread running the shard
+  int status;                          // exit status, as for main
+} shard_t;
+
+// shards report here when their socket is open, then wait for the others,
+// so no message arrives before the kernel knows every socket on the port
+static pthread_mutex_t shardsLock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t shardsChanged = PTHREAD_COND_INITIALIZER;
+static int shardsWaiting = 0;          // shards ready, or failed, to start
+static bool shardsOpen = false;        // true once every shard has reported
+static bool shardsGo = false;          // true if every shard started its loop
+static int shardsRunning = 0;          // shards started and not yet finished
 
 // function prototypes
 // initialization functions and utilities
 static void parseArgs(const int argc, char* argv[], char** filepathname, int* seed);
-static bool initializeGame(char* filepathname, int seed);
-static int generateGold(grid_t* grid, int* piles, int seed);
+static bool initializeGames();
+static game_t* startGame();
+static void closeGames(bool normalExit);
+static int generateGold(game_t* game, int seed);
 static bool strToInt(const char string[], int* number);
+static bool parseOption(const char* option);
+static void seedRandom(unsigned int seed);
+static int nextRandom();
+// running several shards
+static int runShards();
+static void* shardThread(void* arg);
+static bool waitForShards(bool ready);
+static bool finishShard();
+static void waitForAllShards();
+static void pinShard();
+// running the event loop
+static bool runLoop();
+static double timeNow();
+static bool handleIdle(void* arg);
+static bool handleTick(void* arg);
+static bool handleTickMessage(void* arg, const addr_t from, const char* message);
+static bool runTick();
+// routing messages to games
+static game_t* findGame(const addr_t from);
+static game_t* openGame();
+static bool endGame(game_t* game, bool normalExit);
 // game state changes
-static bool handlePlayerConnect(char* playerName, const addr_t from);
-static bool pickupGold(player_t* player);
-static void pickupGoldHelper(void* arg, const char* key, void* item);
-static bool movePlayer(player_t* player, char directionChar);
-static bool movePlayerHelper(player_t* player, int directionValue);
-static void updatePlayersVision();
-static void updateHelper(void* arg, const char* key, void* item);
-static bool handleSpectator(addr_t from);
-static void handlePlayerQuit(player_t* player);
-static void gameOver(bool normalExit);
-static void gameOverHelper(void* arg, const char* key, void* item);
+static bool handlePlayerConnect(game_t* game, char* playerName, const addr_t from);
+static int pickupGold(game_t* game, player_t* player);
+static bool movePlayer(game_t* game, player_t* player, char directionChar);
+static bool movePlayerHelper(game_t* game, player_t* player, int dx, int dy);
+static bool repeatMovePlayerHelper(game_t* game, player_t* player, int dx, int dy);
+static bool stepPlayer(game_t* game, player_t* player, int dx, int dy, int* collected);
+static bool finishMove(game_t* game, player_t* player, int collected);
+static void showChanges(game_t* game, player_t* mover);
+static void updatePlayersVision(game_t* game);
+static void updateHelper(void* arg, int index);
+static void addVisionJob(player_t* player);
+static bool addNearbyVisionJobs(game_t* game, const uint64_t* dirty);
+static int compareVisionJobs(const void* a, const void* b);
+static void deleteVisionJobs();
+static bool handleSpectator(game_t* game, addr_t from);
+static void handlePlayerQuit(game_t* game, player_t* player);
+static void gameOver(game_t* game, bool normalExit);
 // messaging functions
-static void sendGrid(addr_t to);
+static void sendGrid(game_t* game, addr_t to);
 static bool handleMessage(void* arg, const addr_t from, const char* message);
-static void sendGold(player_t* player, int goldCollected);
-static bool handleKey(const char key, addr_t from);
+static void sendGold(game_t* game, player_t* player, int goldCollected);
+static bool handleKey(game_t* game, const char key, addr_t from);
+static bool applyKey(game_t* game, player_t* player, const char key);
 static void sendOK(player_t* player);
-static void sendDisplay(player_t* player, char* displayString);
+static void sendDisplay(player_t* player, grid_t* grid);
+static const char* encodeDisplay(player_t* player, grid_t* grid);
+static void handleDelta(game_t* game, addr_t from);
+static void handleAck(game_t* game, const char* seqString, addr_t from);
 
 /******************** main *******************/
 /* master function for the server
  * initializes all modules
- * loops to receive messages until fatal error or game ends
+ * loops to receive messages until fatal error or game ends,
+ * or with --games, until fatal error, starting new games as others end
  * exits 0 if game ends normally, non-zero if error
  */
 int
@@ -77,9 +192,21 @@ main(const int argc, char* argv[])
 
   // validate arguments
   parseArgs(argc, argv, &filepathname, &seed); log_v("parseargs passed\n");
+  mapPathname = filepathname;
+  firstSeed = seed;
+
+  // each shard sets itself up on a thread of its own
+  if (numShards > 1) {
+    int status = runShards();
+    log_done();
+    exit(status);
+  }
+
   // generate necessary data structures
-  if (! initializeGame(filepathname, seed)) { 
+  if (! initializeGames()) { 
     log_v("failed to initialize game, exiting non-zero");
+    closeGames(false);
+    grid_clearMapCache();
     log_done();
     exit(3);
   } log_v("game initialized\n"); 
@@ -90,7 +217,8 @@ main(const int argc, char* argv[])
   if (ourPort == 0) {
     log_v("err initializing message module");
     // clean up and exit
-    game_delete(game);
+    closeGames(false);
+    grid_clearMapCache();
     log_done();
     exit(1);
   }
@@ -99,12 +227,13 @@ main(const int argc, char* argv[])
   printf("Server listening for messages on port: %d", ourPort);
 
   // handles inbound messages until gameOver or fatal error
-  if (message_loop(NULL, 0, NULL, NULL, handleMessage)) {
-    // if loop completed successfully, send quit info and close down module
+  if (runLoop()) {
+    // if loop completed successfully, the game has already sent quit info
     log_v("quitting game normally");
     // clean up and exit
-    gameOver(true);
+    closeGames(true);
     message_done();
+    grid_clearMapCache();
     log_done();
     exit(0);
   } else {
@@ -112,39 +241,60 @@ main(const int argc, char* argv[])
     // send quit message with error explanation
     log_v("unexpected error in message_loop, quitting game");
     // clean up and exit 
-    gameOver(false);
+    closeGames(false);
     message_done();
+    grid_clearMapCache();
     log_done();
     exit(2);
   }
 }
 
 /****************** parseArgs ******************/
-/* Parses arguments for use in server.c */
+/* Parses arguments for use in server.c
+ * usage: ./server [--option=value ...] map.txt [seed]
+ * options may appear anywhere on the command line, see parseOption
+ */
 static void
 parseArgs(const int argc, char* argv[], char** filepathname, int* seed)
 {
   FILE* fp;                            // file pointer to map file for testing
+  char* positional[2];                 // map file and optional seed
+  int numPositional = 0;               // number of non-option args given
+
+  // separate options from the map file and seed
+  for (int i = 1; i < argc; i++) {
+    if (strncmp(argv[i], "--", 2) == 0) {
+      if ( ! parseOption(argv[i])) {
+        log_s("parseArgs: unknown or invalid option %s", argv[i]);
+        log_done();
+        exit(1);
+      }
+    } else if (numPositional < 2) {
+      positional[numPositional++] = argv[i];
+    } else {
+      numPositional++;
+    }
+  }
 
-  // make sure arg count is 2 or 3 (depending on if seed is passed)
-  if (argc != 2 && argc != 3) {
+  // make sure arg count is 1 or 2 (depending on if seed is passed)
+  if (numPositional != 1 && numPositional != 2) {
     log_v("parseArgs: need either 1 arg (map file) or 2 args (map and seed)");
     log_done();
     exit(1);
   }
 
   // set seed if given
-  if (argc == 3) {
+  if (numPositional == 2) {
     // convert seed string into an integer
-    if ( ! strToInt(argv[2], seed) || *seed < 0) {
-      log_s("Seed: %s not a valid integer", argv[2]);
+    if ( ! strToInt(positional[1], seed) || *seed < 0) {
+      log_s("Seed: %s not a valid integer", positional[1]);
       log_done();
       exit(2);
     }
   }
   
   // check filepathname is not NULL
-  if ((*filepathname = argv[1]) == NULL) {
+  if ((*filepathname = positional[0]) == NULL) {
     log_v("parseArgs: NULL arg given");
     log_done();
     exit(1);
@@ -160,6 +310,64 @@ parseArgs(const int argc, char* argv[], char** filepathname, int* seed)
   fclose(fp);
 }
 
+/************* parseOption ***************/
+/* parses a single "--name=value" command line option
+ * supported options:
+ *   --vision=raycast|shadowcast  selects the vision engine
+ *   --vistable=on|off            precompute vision from every tile at load
+ *   --threads=N                  update players' vision on N threads (N >= 1)
+ *   --viscache=N                 cache the last N visible sets computed (0 disables)
+ *   --maxplayers=N               let up to N players join (N >= 1, default 26);
+ *                                past 26, players share letters on the map
+ *   --games=N                    host up to N games at once (N >= 1), and keep 
+ *                                starting new ones as others fill up or end
+ *   --shards=N                   run N event loops (N >= 1) on one port, each on 
+ *                                its own core with its own games (see runShards)
+ *   --tick=HZ                    apply keys HZ times a second (HZ >= 0), followed
+ *                                by one vision update per game (see runTick);
+ *                                0, the default, applies each key as it arrives
+ * returns true if the option was recognized and valid, false otherwise
+ */
+static bool parseOption(const char* option)
+{
+  if (strcmp(option, "--vision=raycast") == 0) {
+    visionMode = VISION_RAYCAST;
+    return true;
+  }
+  if (strcmp(option, "--vision=shadowcast") == 0) {
+    visionMode = VISION_SHADOWCAST;
+    return true;
+  }
+  if (strcmp(option, "--vistable=on") == 0) {
+    useVisTable = true;
+    return true;
+  }
+  if (strcmp(option, "--vistable=off") == 0) {
+    useVisTable = false;
+    return true;
+  }
+  if (strncmp(option, "--viscache=", strlen("--viscache=")) == 0) {
+    return strToInt(option + strlen("--viscache="), &visCacheSize) && visCacheSize >= 0;
+  }
+  if (strncmp(option, "--threads=", strlen("--threads=")) == 0) {
+    return strToInt(option + strlen("--threads="), &numThreads) && numThreads >= 1;
+  }
+  if (strncmp(option, "--maxplayers=", strlen("--maxplayers=")) == 0) {
+    return strToInt(option + strlen("--maxplayers="), &maxPlayers) && maxPlayers >= 1;
+  }
+  if (strncmp(option, "--games=", strlen("--games=")) == 0) {
+    multiGame = true;
+    return strToInt(option + strlen("--games="), &maxGames) && maxGames >= 1;
+  }
+  if (strncmp(option, "--shards=", strlen("--shards=")) == 0) {
+    return strToInt(option + strlen("--shards="), &numShards) && numShards >= 1;
+  }
+  if (strncmp(option, "--tick=", strlen("--tick=")) == 0) {
+    return strToInt(option + strlen("--tick="), &tickRate) && tickRate >= 0;
+  }
+  return false;
+}
+
 /************* strToInt ******************/
 /* convert a given string of all numbers to an integer
  * taken from knowledge units
@@ -172,64 +380,544 @@ static bool strToInt(const char string[], int* number)
   return (sscanf(string, "%d%c", number, &nextChar) == 1);
 }
 
-/******************* initializeGame *************/
-/* set up data structures for game 
- * allocates memory for the global game struct using game_new
- * which must later be free'd using game_delete
+/************* seedRandom **************/
+/* seeds this thread's shard's random numbers, which then follow the same 
+ * sequence as rand() would after srand(seed), without sharing its state
+ * with the games of other shards
+ */
+static void seedRandom(unsigned int seed)
+{
+  initstate_r(seed, randomState, sizeof(randomState), &randomData);
+}
+
+/************* nextRandom **************/
+/* returns the next of this thread's shard's random numbers, like rand()
+ * seedRandom must have been called first
+ */
+static int nextRandom()
+{
+  int32_t number;                      // number drawn
+
+  random_r(&randomData, &number);
+  return number;
+}
+
+/******************* initializeGames *************/
+/* set up this thread's shard for hosting games on the server's map
+ * allocates the table of games, and starts the first using startGame;
+ * each game must later be ended with gameOver,
+ * and everything else released with closeGames
+ * returns false if the first game can't be started
  */
 static bool
-initializeGame(char* filepathname, int seed)
+initializeGames()
 {
+  games = mem_calloc_assert(maxGames, sizeof(game_t*), "failed to alloc games\n");
+
+  // start the threads that update vision, falling back to this one
+  if (numThreads > 1 && (visionPool = workpool_new(numThreads)) == NULL) {
+    log_v("failed to start vision threads, updating vision on one thread");
+  }
+
+  // every later game is started when someone needs one (see openGame)
+  return (games[0] = startGame()) != NULL;
+}
+
+/******************* startGame *************/
+/* set up a new game on the server's map, seeded with the next seed
+ * games are numbered across shards in turn, so no two get the same seed
+ * allocates memory for the game struct using game_new
+ * which must later be free'd using game_delete
+ * the map file is only read for the first game; later ones share it,
+ * with its visibility table (see grid_buildVisibility)
+ * returns the game, or NULL if it can't be created
+ */
+static game_t*
+startGame()
+{
+  game_t* game = NULL;                 // game being started
   grid_t* serverGrid = NULL;           // master grid held by server
+  mem_arena_t* arena = NULL;           // holds all of the game's state
   int numPiles;                        // number of gold piles generated
+  bool haveVisTable = false;           // true if the visibility table was built
+  int number = shardIndex + numShards * gamesStarted++; // games started before
+  int seed = firstSeed + number;       // seeds the game's gold
+
+  // everything that lasts as long as the game is allocated from one arena,
+  // and released in one call by game_delete
+  if ((arena = mem_arena_new(0)) == NULL) {
+    log_v("failed to create game arena");
+    return NULL;
+  }
   // create the grid
-  if ((serverGrid = grid_new(filepathname)) == NULL) {
+  if ((serverGrid = grid_new(mapPathname, arena)) == NULL) {
     log_v("err loading grid from file");
-    return false;
+    mem_arena_delete(arena);
+    return NULL;
   }
-  
-  // create and check piles array
-  size_t toAlloc = (goldMaxNumPiles * sizeof(int));
-  int* goldPiles = mem_malloc_assert(toAlloc, "failed to alloc piles");
-  // set all values in the array to -1
-  for(int i = 0; i < goldMaxNumPiles; i++){
-    goldPiles[i] = -1;
+  grid_setVisionMode(serverGrid, visionMode);
+
+  // trade startup time for a table lookup on every vision update
+  if (useVisTable && ! (haveVisTable = grid_buildVisibility(serverGrid))) {
+    log_v("failed to build visibility table, calculating vision per move");
   }
 
-  // randomly distribute gold
-  numPiles = generateGold(serverGrid, goldPiles, seed); 
-  log_v("generated gold");
-  log_v("piles array initially:");
-  for (int i = 0; i < goldMaxNumPiles; i++) {
-    log_d("%d", goldPiles[i]);
+  // create game state
+  if ((game = game_new(serverGrid, maxPlayers, arena)) == NULL) {
+    log_v("failed to create game");
+    grid_delete(serverGrid);
+    mem_arena_delete(arena);
+    return NULL;
   }
-  
-  // create global game state
-  game = game_new(goldPiles, serverGrid);
-  game_setNumPiles(game, numPiles);
   log_v("created game");
 
-  return true;
+  // randomly distribute gold
+  numPiles = generateGold(game, seed); 
+  if (numPiles == 0) {
+    log_v("no room in map for any gold");
+    game_delete(game);
+    return NULL;
+  }
+  log_d("generated %d piles of gold", numPiles);
+
+  // without a table, remember recent fields of view instead
+  if ( ! haveVisTable && visCacheSize > 0) {
+    game_setVisionCache(game, viscache_new(visCacheSize, grid_getMapLen(serverGrid),
+                                           grid_getVisionWords(serverGrid)));
+  }
+
+  log_d("started game %d", number + 1);
+  return game;
+}
+
+/******************* closeGames *************/
+/* ends every game still running on this thread's shard with gameOver, 
+ * then frees the table of games and everything shared by the games,
+ * except the map cache, which main clears once every shard is closed
+ */
+static void
+closeGames(bool normalExit)
+{
+  for (int i = 0; games != NULL && i < maxGames; i++) {
+    if (games[i] != NULL) {
+      gameOver(games[i], normalExit);
+      games[i] = NULL;
+    }
+  }
+  mem_free(games);
+  games = NULL;
+  deleteVisionJobs();
+}
+
+/************* findGame **************/
+/* returns the game in which a player or spectator has the given address,
+ * which is where that client's messages go, or NULL if there is none
+ */
+static game_t*
+findGame(const addr_t from)
+{
+  for (int i = 0; i < maxGames; i++) {
+    if (games[i] != NULL && game_getPlayerAtAddr(games[i], from) != NULL) {
+      return games[i];
+    }
+  }
+  return NULL;
+}
+
+/************* openGame **************/
+/* returns the game a new client should join: the first with room for
+ * another player, or else a new game if there is a free slot for one.
+ * With no room anywhere, returns the first game, which turns players away,
+ * or NULL if no game is running and none can be started
+ */
+static game_t*
+openGame()
+{
+  int freeSlot = -1;                   // first slot with no game in it
+  game_t* full = NULL;                 // first game with no room left
+
+  for (int i = 0; i < maxGames; i++) {
+    if (games[i] == NULL) {
+      if (freeSlot < 0) {
+        freeSlot = i;
+      }
+    } else if (game_getNumPlayers(games[i]) < maxPlayers) {
+      return games[i];
+    } else if (full == NULL) {
+      full = games[i];
+    }
+  }
+
+  // only a server hosting several games starts another
+  if (freeSlot < 0 || ! multiGame) {
+    return full;
+  }
+  if ((games[freeSlot] = startGame()) == NULL) {
+    log_v("failed to start another game");
+    return full;
+  }
+  return games[freeSlot];
+}
+
+/************* endGame **************/
+/* ends the given game with gameOver, freeing its slot for another
+ * returns true if the server should stop, because it only hosts one game,
+ * and with several shards, every other shard's game has ended too
+ */
+static bool
+endGame(game_t* game, bool normalExit)
+{
+  for (int i = 0; i < maxGames; i++) {
+    if (games[i] == game) {
+      games[i] = NULL;
+    }
+  }
+  gameOver(game, normalExit);
+  return ! multiGame && finishShard();
+}
+
+/************* runShards **************/
+/* runs the server as numShards shards, each with its own socket on one port, 
+ * its own event loop, pinned to a core, and its own games, which no other 
+ * thread touches; the kernel sends every message from a client to the same 
+ * socket (see message_initShared), so a client's games all live on one shard
+ * shard 0 runs on this thread and picks the port; the others get a thread each,
+ * and none starts looping until every socket is open
+ * a shard whose game has ended keeps its socket open and turns new clients away
+ * until every shard has finished, as closing it would send some of the
+ * other shards' clients to a shard that doesn't know them
+ * returns main's exit status: 0 if every shard ended normally, otherwise
+ * the status of the first shard that did not
+ */
+static int
+runShards()
+{
+  shard_t* shards;                     // every shard, this thread's first
+  int numStarted = 1;                  // shards with a thread, counting this one
+  int status = 0;                      // exit status
+
+  shards = mem_calloc_assert(numShards, sizeof(shard_t), "failed to alloc shards\n");
+
+  // shard 0 opens the port first, so the others know which port to share
+  if ( ! initializeGames()) {
+    log_v("failed to initialize game, exiting non-zero");
+    shards[0].status = 3;
+  } else if ((shards[0].port = message_initShared(stderr, 0)) == 0) {
+    log_v("err initializing message module");
+    shards[0].status = 1;
+  } else {
+    for (; numStarted < numShards; numStarted++) {
+      shards[numStarted].index = numStarted;
+      shards[numStarted].port = shards[0].port;
+      if (pthread_create(&shards[numStarted].thread, NULL, 
+                         shardThread, &shards[numStarted]) != 0) {
+        log_d("failed to start shard %d", numStarted);
+        shards[0].status = 1;
+        break;
+      }
+    }
+  }
+
+  // wait for the other shards to set up, then start them all, or none
+  pthread_mutex_lock(&shardsLock);
+  while (shardsWaiting < numStarted - 1) {
+    pthread_cond_wait(&shardsChanged, &shardsLock);
+  }
+  shardsRunning = numStarted;
+  pthread_mutex_unlock(&shardsLock);
+  for (int i = 1; i < numStarted; i++) {
+    if (shards[0].status == 0) {
+      shards[0].status = shards[i].status;
+    }
+  }
+  if (waitForShards(shards[0].status == 0)) {
+    log_d("server listening on port %d", shards[0].port);
+    printf("Server listening for messages on port: %d", shards[0].port);
+    fflush(stdout);
+    pinShard();
+    shards[0].status = runLoop() ? 0 : 2;
+  }
+  closeGames(shards[0].status == 0);
+  finishShard();
+
+  // the server is done once every shard is, and only then closes its socket
+  for (int i = 1; i < numStarted; i++) {
+    pthread_join(shards[i].thread, NULL);
+  }
+  message_done();
+  for (int i = 0; i < numStarted && status == 0; i++) {
+    status = shards[i].status;
+  }
+  mem_free(shards);
+  grid_clearMapCache();
+  log_d("all shards closed, exiting %d", status);
+  return status;
+}
+
+/************* shardThread **************/
+/* runs one shard on a thread started by runShards, passed its shard_t as arg
+ * sets up the shard's games and socket, waits for the other shards,
+ * then handles its messages until every shard's games end or a fatal error,
+ * keeping its socket open until every shard has finished
+ * leaves the shard's exit status in the shard_t, and returns NULL
+ */
+static void*
+shardThread(void* arg)
+{
+  shard_t* shard = arg;                // this thread's shard
+
+  shardIndex = shard->index;
+  if ( ! initializeGames()) {
+    log_d("failed to initialize game on shard %d", shardIndex);
+    shard->status = 3;
+  } else if (message_initShared(stderr, shard->port) == 0) {
+    log_d("err initializing message module on shard %d", shardIndex);
+    shard->status = 1;
+  }
+  if (waitForShards(shard->status == 0)) {
+    pinShard();
+    shard->status = runLoop() ? 0 : 2;
+  }
+  closeGames(shard->status == 0);
+  finishShard();
+  waitForAllShards();
+  message_done();
+  return NULL;
+}
+
+/************* waitForShards **************/
+/* called by each shard once it is set up, or has failed to be, 
+ * saying which with ready; runShards calls it last, once the others have
+ * returns true once every shard is ready, so they may all start looping,
+ * or false as soon as it is known that one is not
+ */
+static bool
+waitForShards(bool ready)
+{
+  bool go;                             // true if every shard is ready
+
+  pthread_mutex_lock(&shardsLock);
+  if (shardIndex == 0) {
+    shardsGo = ready;
+    shardsOpen = true;
+  } else {
+    shardsWaiting++;
+  }
+  pthread_cond_broadcast(&shardsChanged);
+  while ( ! shardsOpen) {
+    pthread_cond_wait(&shardsChanged, &shardsLock);
+  }
+  go = shardsGo && ready;
+  pthread_mutex_unlock(&shardsLock);
+  return go;
+}
+
+/************* finishShard **************/
+/* records that this thread's shard has finished: its game has ended,
+ * or its loop stopped, or never started; only counts the first call
+ * returns true once every shard has finished, or if there is only one
+ */
+static bool
+finishShard()
+{
+  bool allDone;                        // true if every shard has finished
+
+  if (numShards == 1) {
+    return true;
+  }
+  pthread_mutex_lock(&shardsLock);
+  if ( ! shardFinished) {
+    shardFinished = true;
+    shardsRunning--;
+    pthread_cond_broadcast(&shardsChanged);
+  }
+  allDone = shardsRunning == 0;
+  pthread_mutex_unlock(&shardsLock);
+  return allDone;
+}
+
+/************* waitForAllShards **************/
+/* waits until every shard has finished (see finishShard) */
+static void
+waitForAllShards()
+{
+  pthread_mutex_lock(&shardsLock);
+  while (shardsRunning > 0) {
+    pthread_cond_wait(&shardsChanged, &shardsLock);
+  }
+  pthread_mutex_unlock(&shardsLock);
+}
+
+/************* pinShard **************/
+/* pins the calling thread to a core picked by its shard number,
+ * so each event loop keeps a core, and that core's caches, to itself
+ * threads started later inherit the pin, so the shard's vision threads 
+ * must already be running (see initializeGames)
+ * logs and carries on unpinned if that fails
+ */
+static void
+pinShard()
+{
+  long numCores = sysconf(_SC_NPROCESSORS_ONLN); // cores online
+  cpu_set_t cores;                     // the one core to run on
+
+  if (numCores < 1) {
+    return;
+  }
+  CPU_ZERO(&cores);
+  CPU_SET(shardIndex % numCores, &cores);
+  if (pthread_setaffinity_np(pthread_self(), sizeof(cores), &cores) != 0) {
+    log_d("could not pin shard %d to a core", shardIndex);
+  }
+}
+
+/************* runLoop **************/
+/* handles inbound messages on this thread's socket with message_loop,
+ * until a game ends on a server hosting one, or a fatal error;
+ * with several shards, until every shard's game has ended
+ * in tick mode, also wakes up a few times a tick to run any tick that is due
+ * returns message_loop's result
+ */
+static bool
+runLoop()
+{
+  if (tickRate == 0 && numShards == 1) {
+    return message_loop(NULL, 0, NULL, NULL, handleMessage);
+  }
+  // a shard whose game has ended wakes up now and then to see if the rest have
+  if (tickRate == 0) {
+    return message_loop(NULL, shardIdleTimeout, handleIdle, NULL, handleMessage);
+  }
+  nextTick = timeNow() + 1.0 / tickRate;
+  return message_loop(NULL, 0.25 / tickRate, handleTick, NULL, handleTickMessage);
+}
+
+/************* timeNow **************/
+/* returns the time in seconds, from a clock that only moves forward */
+static double
+timeNow()
+{
+  struct timespec now;                 // time on the monotonic clock
+
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+/************* handleIdle **************/
+/* helper for message_loop on a shard, called when it times out
+ * returns true if the loop should end: once this shard has finished,
+ * and so has every other
+ */
+static bool
+handleIdle(void* arg)
+{
+  bool allDone;                        // true if every shard has finished
+
+  if ( ! shardFinished) {
+    return false;
+  }
+  pthread_mutex_lock(&shardsLock);
+  allDone = shardsRunning == 0;
+  pthread_mutex_unlock(&shardsLock);
+  return allDone;
+}
+
+/************* handleTick **************/
+/* helper for message_loop in tick mode, called when it times out
+ * runs a tick with runTick if one is due, and schedules the next;
+ * a server that falls behind skips the ticks it missed, rather than
+ * running them back to back
+ * returns true if the loop should end, as for handleMessage
+ */
+static bool
+handleTick(void* arg)
+{
+  double now = timeNow();              // time at this call
+
+  // a finished shard has no games to tick, and only waits for the others
+  if (shardFinished) {
+    return handleIdle(arg);
+  }
+  if (now < nextTick) {
+    return false;
+  }
+  nextTick += 1.0 / tickRate;
+  if (nextTick <= now) {
+    nextTick = now + 1.0 / tickRate;
+  }
+  return runTick();
+}
+
+/************* handleTickMessage **************/
+/* helper for message_loop in tick mode: handles the message with handleMessage,
+ * then runs a tick if one has come due, so ticks keep to time under heavy input
+ * returns true if the loop should end, as for handleMessage
+ */
+static bool
+handleTickMessage(void* arg, const addr_t from, const char* message)
+{
+  return handleMessage(arg, from, message) || handleTick(arg);
+}
+
+/************* runTick **************/
+/* applies the keys queued in each of this shard's games since the last tick,
+ * in the order they arrived, with applyKey, then updates each game's players
+ * once with updatePlayersVision, if anything changed; however fast clients 
+ * type, each game sends at most one DISPLAY per player per tick
+ * a game whose last gold is collected ends there, and its other keys are dropped
+ * returns true if the loop should end, because such a game was the server's only one
+ */
+static bool
+runTick()
+{
+  game_t* game;                        // game being updated
+  player_t* player;                    // player who sent the next key
+  char key;                            // the key
+  bool over;                           // true once the game's last gold is taken
+
+  for (int i = 0; i < maxGames; i++) {
+    if ((game = games[i]) == NULL) {
+      continue;
+    }
+    over = false;
+    while ( ! over && (player = game_nextKey(game, &key)) != NULL) {
+      over = applyKey(game, player, key);
+    }
+    if (over) {
+      if (endGame(game, true)) {
+        return true;
+      }
+      continue;
+    }
+    grid_t* grid = game_getGrid(game);
+    if (bitset_next(grid_getDirty(grid), grid_getVisionWords(grid), 0) >= 0) {
+      updatePlayersVision(game);
+    }
+  }
+  return false;
 }
 
 /************* generateGold **************/
 /* randomly generates piles of gold and adds them to the map
+ * and to the game's piles
  * returns the number of piles generated 
+ * if the map runs out of empty room tiles, the last pile placed gets the rest 
+ * of the gold, so the result may be 0 if the map has no room tiles at all
  * helper for initializeGame
  */
-static int generateGold(grid_t* grid, int* piles, int seed)
+static int generateGold(game_t* game, int seed)
 {
+  grid_t* grid = game_getGrid(game);         // server grid
+  int piles[goldMaxNumPiles];                // gold in each pile
   int totalGold = GoldTotal;                 // max gold
   int currPile = 0;                          // value (gold) of current pile
   int currIndex = 0;                         // index into array
   int tmp = 0;                               // temp int
-  char* active = grid_getActive(grid);       // server active map
-  int gridLen = grid_getMapLen(grid);        // length of map string
   int pilesInserted = 0;
   int slot = 0;
 
   // seed random gen
-  srand(seed);
+  seedRandom(seed);
 
   // generating random piles
   // loops until no more gold to distribute
@@ -240,7 +928,7 @@ static int generateGold(grid_t* grid, int* piles, int seed)
       currPile = totalGold;
       totalGold = 0;
     } else {
-      tmp = rand();
+      tmp = nextRandom();
       // divides to get a more balanced distribution
       currPile = (tmp % (totalGold/goldMinNumPiles));
       // if random number is greater than gold left to distribute
@@ -261,18 +949,26 @@ static int generateGold(grid_t* grid, int* piles, int seed)
   // insert piles into map
   // loop over all piles of gold
   while ( pilesInserted < currIndex ) {   // we don't want to insert more piles than we have
-    
-    tmp = rand();
-    slot = (tmp % gridLen);
-
-    if ( active[slot] == ROOMTILE ) { // we only insert into valid spaces in the map
-      if (grid_replace(grid, slot, GOLDTILE)) {  
-        log_d("added gold at index %d", slot);
-        pilesInserted++;
-      } else {
-        log_v("initializeGame: err inserting pile in map");
+    int numEmpty = grid_getNumEmptyTiles(grid);
+
+    // out of room: the last pile placed takes the rest of the gold
+    if ( numEmpty == 0 ) {
+      log_d("no room in map for %d more piles", currIndex - pilesInserted);
+      for ( int i = pilesInserted; i < currIndex && pilesInserted > 0; i++ ) {
+        game_addPile(game, slot, piles[i]);
       }
-    } 
+      return pilesInserted;
+    }
+
+    // pick any empty room tile, uniformly
+    slot = grid_getEmptyTile(grid, nextRandom() % numEmpty);
+    if (grid_replace(grid, slot, GOLDTILE) 
+        && game_addPile(game, slot, piles[pilesInserted])) {  
+      log_d("added gold at index %d", slot);
+      pilesInserted++;
+    } else {
+      log_v("initializeGame: err inserting pile in map");
+    }
   }
   return currIndex;
 }
@@ -295,16 +991,12 @@ static int generateGold(grid_t* grid, int* piles, int seed)
  * returns true on success or non-critical error
  * false if critical error at any point in the function
  */
-static bool handlePlayerConnect(char* playerName, addr_t from)
+static bool handlePlayerConnect(game_t* game, char* playerName, addr_t from)
 {
   player_t* player;                      // stores information for given player
   int nameLen;                           // length of playerName
   int randPos;                           // random position to drop player
-  int mapLen;                            // length of in game map
-  grid_t* grid;                          // game grid
-  char* activeMap;                       // active map of current game
-  int lastCharID;                        // most recently assigned player 'character'
-  bool emptySpace = false;               // true iff there is > 1 ROOMTILE in map
+  grid_t* grid = game_getGrid(game);     // game grid
   char* mapfile = game_getMapfile(game); // game map used to initialize player vision
 
   // check params (non-critical)
@@ -318,8 +1010,8 @@ static bool handlePlayerConnect(char* playerName, addr_t from)
   }
   
   // check for maxPlayers (recoverable)
-  if (game_getNumPlayers(game) == MaxPlayers) { 
-    log_v("ignoring player connect, MAXPLAYERS already reached");
+  if (game_getNumPlayers(game) >= maxPlayers) { 
+    log_v("ignoring player connect, maxPlayers already reached");
     message_send(from, "QUIT Game is full: no more players can join.");
     // returns true because error is recoverable
     return true;
@@ -348,9 +1040,17 @@ static bool handlePlayerConnect(char* playerName, addr_t from)
     return true;
   }
 
+  // check for room before the player is created and added to the game
+  if ( ! grid_containsEmptyTile(grid)) {
+    log_s("no room in map to add player: %s", playerName);
+    message_send(from, "QUIT no room in map to add you");
+    // non-critical error
+    return true;
+  }
+
   // initialize player and add to hashtable
   // create and check player
-  if ((player = player_new(playerName, mapfile)) == NULL) {
+  if ((player = player_new(playerName, mapfile, game_getArena(game))) == NULL) {
     log_s("could not create player named: %s", playerName);
     // critical malloc error
     return false;
@@ -365,48 +1065,24 @@ static bool handlePlayerConnect(char* playerName, addr_t from)
   }
 
   // set attributes
-  player_setAddr(player, from);
-  // game holds charID as int so must be cast to char
-  lastCharID = game_getLastCharID(game);
-  player_setCharID(player, (char)(lastCharID));
-  
-  // randomize initial position
-  // get length of map and map itself
-  grid = game_getGrid(game);
-  mapLen = grid_getMapLen(grid);
-  activeMap = grid_getActive(grid);
-
-  // check for existence of empty spaces, true if there is at least 1
-  emptySpace = grid_containsEmptyTile(grid);
-
-  // clean up and return if no space to add player
-  if (! emptySpace) {
-    log_s("no room in map to add player: %s", playerName);
-    player_delete(player);
-    message_send(from, "QUIT no room in map to add you");
-    // non-critical error
-    return true;
-  }
-  // loop until valid pos found
-  while (true) {
-    // constrain rand to the length of the map string
-    randPos = (rand() % mapLen);
-    // if empty room tile
-    if (activeMap[randPos] == ROOMTILE) {
-      // set player pos and update server active map
-      player_setPos(player, randPos);
-      grid_replace(grid, randPos, player_getCharID(player));
-      break;
-    }
+  if ( ! game_setPlayerAddr(game, player, from)) {
+    log_s("failed to index address of player named: %s", playerName);
+    // critical error
+    return false;
   }
   
+  // drop the player on any empty room tile, uniformly
+  randPos = grid_getEmptyTile(grid, nextRandom() % grid_getNumEmptyTiles(grid));
+  game_movePlayer(game, player, randPos);
+  grid_replace(grid, randPos, player_getCharID(player));
+  
   // update client with their ID and the state of the game
   sendOK(player);
-  sendGrid(from);
-  sendGold(player, 0);                 // a player has no gold on entry
+  sendGrid(game, from);
+  sendGold(game, player, 0);                 // a player has no gold on entry
 
   // update all player's vision with new information
-  updatePlayersVision();
+  showChanges(game, player);
   // return after successfully initializing all player values
   return true;
 }
@@ -420,10 +1096,10 @@ static bool handlePlayerConnect(char* playerName, addr_t from)
  * 
  * returns true if successful or non-critical error
  * false if otherwise
- * NOTE: since spectator is in hashtable
- * if looping over all players be sure to ignore those named "spectator" when appropriate
+ * NOTE: since spectator is in the roster, if looping over all players 
+ * be sure to ignore the one whose role is ROLE_SPECTATOR when appropriate
  */
-static bool handleSpectator(addr_t from)
+static bool handleSpectator(game_t* game, addr_t from)
 { 
   player_t* spectator;                   // struct to hold the spectator
   char* mapfile = game_getMapfile(game); // mapfile used by the server
@@ -436,20 +1112,25 @@ static bool handleSpectator(addr_t from)
   }
 
   // disconnect current spectator if they exist
-  if ((spectator = game_getPlayer(game, "spectator")) != NULL) {
+  if ((spectator = game_getSpectator(game)) != NULL) {
     // send quit message to current spectator
     message_send(player_getAddr(spectator), 
                  "QUIT you have been replaced by a new spectator");
     // set spectator's address to new spectator
-    player_setAddr(spectator, from);
-    sendDisplay(spectator, grid_getActive(game_getGrid(game)));
-    sendGold(spectator, 0);
-    sendGrid(from);
+    if ( ! game_setPlayerAddr(game, spectator, from)) {
+      log_v("failed to index address of new spectator");
+      return false;
+    }
+    // the new spectator gets whole DISPLAY messages until they ask for deltas
+    player_setDelta(spectator, NULL);
+    sendDisplay(spectator, game_getGrid(game));
+    sendGold(game, spectator, 0);
+    sendGrid(game, from);
     return true;
   }
 
   // create special spectator player if one not present
-  if ((spectator = player_new("spectator", mapfile)) == NULL) {
+  if ((spectator = player_new("spectator", mapfile, game_getArena(game))) == NULL) {
     log_v("could not allocate player struct for spectator");
     // critical error
     return false;
@@ -465,13 +1146,16 @@ static bool handleSpectator(addr_t from)
   // set relevant attributes if added to game
   // note that vision does not need to be send
   // spectator's display is always server's active map
-  player_setAddr(spectator, from);
+  if ( ! game_setPlayerAddr(game, spectator, from)) {
+    log_v("failed to index address of spectator");
+    return false;
+  }
   
   // update spectator client
-  sendGrid(from);
-  sendDisplay(spectator, grid_getActive(game_getGrid(game)));
+  sendGrid(game, from);
+  sendDisplay(spectator, game_getGrid(game));
   // spectator collects no gold so send 0
-  sendGold(spectator, 0);
+  sendGold(game, spectator, 0);
   return true;
 
 }
@@ -482,7 +1166,7 @@ static bool handleSpectator(addr_t from)
  * and sends them an appropriate quit message
  * does nothing if the player does not exist
  */
-static void handlePlayerQuit(player_t* player) 
+static void handlePlayerQuit(game_t* game, player_t* player) 
 {
   grid_t* gameGrid = game_getGrid(game);  // global game's grid
 
@@ -493,283 +1177,248 @@ static void handlePlayerQuit(player_t* player)
 
   // remove player from the game map and send message
   grid_revertTile(gameGrid, player_getPos(player));
+  game_movePlayer(game, player, -1);
   message_send(player_getAddr(player), "QUIT Thanks for playing!\n");
+  // further keystrokes from this address are ignored, and nothing more is sent
+  game_setPlayerAddr(game, player, message_noAddr());
+  player_setDelta(player, NULL);
   // remove player from all other's screens
-  updatePlayersVision();
+  showChanges(game, NULL);
 }
 
 /*************** gameOver ******************/
-/* the gameOver function encapsulates the process of ending the game
+/* the gameOver function encapsulates the process of ending the given game
  * it takes a boolean parameter 
  * that indicates the circumstances of the game ending
  * calls game_delete, free'ing all memory held within the game struct
  * if its true, the game is exiting because the all the gold was collected
  * if false, the game is exiting due to a critical error
  */ 
-static void gameOver(bool normalExit)
+static void gameOver(game_t* game, bool normalExit)
 {
-  hashtable_t* playerTable;            // table of players in game
-  playerTable = game_getPlayers(game);
-  char* gameSummary;                   // game over summary table
+  char* gameSummary = NULL;            // game over summary table
+  viscache_t* cache = game_getVisionCache(game); // shared vision cache
+  const addr_t* addrs = game_getRosterAddr(game); // where each player is
+
+  // report how well the vision cache did, to help size it for this map
+  if (cache != NULL) {
+    log_d("vision cache capacity %d", viscache_getCapacity(cache));
+    log_d("vision cache hits %d", (int)viscache_getHits(cache));
+    log_d("vision cache misses %d", (int)viscache_getMisses(cache));
+  }
 
-  // exit procedure if error
-  if ( ! normalExit) {
-    // log, send message, and clean up memory then return to main
+  if (normalExit) {
+    // build summary table
+    log_v("calling gameOver(success)");
+    gameSummary = game_buildSummary(game);
+    log_s("gameSummary: is %s", gameSummary);
+  } else {
     log_v("calling gameOver(error)");
-    hashtable_iterate(playerTable, &normalExit, gameOverHelper);
-    game_delete(game);
-    return;
   }
 
-  // procedure if game successfully completed
-  log_v("calling gameOver(success)");
-  // build summary table
-  gameSummary = game_buildSummary(game);
-  log_s("gameSummary: is %s", gameSummary);
-  // to pass into hashtable_iterate
-  void* container[2] = {&normalExit, gameSummary};
+  // send the summary, or news of the error, to everyone who has not quit
+  for (int i = 0; i < game_getRosterSize(game); i++) {
+    if ( ! message_isAddr(addrs[i])) {
+      continue;
+    }
+    if (normalExit) {
+      message_send(addrs[i], gameSummary);
+    } else {
+      message_send(addrs[i], "QUIT server encountered a critical error\n");
+    }
+  }
 
-  // send table to all clients
-  hashtable_iterate(playerTable, container, gameOverHelper);
-  // clean up
+  // clean up, leaving what the games share to closeGames
   game_delete(game);
   free(gameSummary);
 }
 
-/************** gameOverHelper *************/
-/* sends appropriate messages to all players
- * for use in gameOver, passed to hashtable_iterate
- */
-static void gameOverHelper(void* arg, const char* key, void* item)
-{
-  void** container = arg;
-  // extract player and exit status from arg
-  player_t* player = item;
-  bool* normalExit = container[0];
-  // log status of bool
-  if (*normalExit) {
-    log_v("normalExit true");
-  } else {
-    log_v("normalExit false");
-  }
-
-  char* gameSummary = container[1];    // summary of game for normal exit
-  log_s("gameSummary initial: %s", gameSummary);
-
-  // set the address to send messages to
-  addr_t to = player_getAddr(player);
-
-  // send current player a quit message
-  if (! *normalExit) {
-    message_send(to, "QUIT server encountered a critical error\n");
-  } else {
-    log_s("sending summary: %s", gameSummary);
-    message_send(to, gameSummary);
-  }
-}
-
 /***************** pickupGold *************/
 /* handles case where client picks up gold
  * passed a player, who is the one picking up the gold
- * returns true if last pile picked up (no more gold left after player gets it)
- * so that it can be returned up the chain all the way to handleMessage
- * so that handleMessage can exit properly and the game can end
- * returns false if otherwise
+ * takes the pile where they stand and adds it to their purse,
+ * leaving it to finishMove to tell the players
+ * returns the nuggets picked up, 0 if there was no pile there
  */
-static bool
-pickupGold(player_t* player)
+static int
+pickupGold(game_t* game, player_t* player)
 {
-  int* piles = game_getPiles(game);   // array of gold piles in game
+  int gold;                            // nuggets in the pile picked up
 
   // check params and values
-  if (player == NULL || piles == NULL) {
+  if (player == NULL) {
     log_v("bad params in pickupGold");
-    return false;
+    return 0;
   }
 
-  // update player gold total
-  for (int i = 0; i < game_getNumPiles(game); i++) {
-    const int currPile = piles[i];
-    // skip empty piles
-    if (currPile == -1) {
-      log_d("skipping empty pile of gold, value is: %d", piles[i]);
-      continue;
-    }
-    // modify player and game state
-    player_addGold(player, currPile);
-    game_subtractGold(game, currPile);
-    piles[i] = -1;
-    
-    // notify player
-    sendGold(player, currPile);
-
-    // notify all players of new gold state using GOLD message w/ 0 picked up
-    hashtable_iterate(game_getPlayers(game), player, pickupGoldHelper);
-    // exit loop once gold picked up
-    break;
+  // take the pile where the player is standing
+  if ((gold = game_takePile(game, player_getPos(player))) == 0) {
+    log_d("no pile of gold at %d", player_getPos(player));
+    return 0;
   }
 
-  // return up the chain to trigger gameOver if all gold collected
-  if (game_getRemainingGold(game) == 0) {
-    return true;
-  }
-
-  // don't trigger gameOver if there is still gold
-  return false;
+  // modify player and game state
+  game_addPlayerGold(game, player, gold);
+  game_subtractGold(game, gold);
+  return gold;
 }
 
-/************* pickupGoldHelper *************/
-/* sends the GOLD message to a client saying they picked up 0 gold
- * for use in pickupGold, passed to hashtable_iterate
- * with the appropriate information after its called in pickupGold
- * serves only to update all players about the game state
- * when a player picks up gold
+/************* repeatMovePlayerHelper **********/
+/* repeatedly moves a player by the given number of columns (dx) and rows (dy)
+ * each of which is -1, 0 or 1, until they run into a wall
+ * the whole run, with the gold picked up and players swapped along the way,
+ * is worked out in one walk with stepPlayer, and the other players are only
+ * shown where it ended, by a single finishMove
+ * the mover's own vision follows each step, so they remember what they passed
+ * returns true if, at any point in the "big move", the last gold is collected
+ * false if otherwise
  */
-static void pickupGoldHelper(void* arg, const char* key, void* item) 
+static bool
+repeatMovePlayerHelper(game_t* game, player_t* player, int dx, int dy)
 {
-  // extract from params
-  player_t* triggerPlayer = arg;       // player who picked up gold
-  player_t* currPlayer = item;         // current player in iteration
-
-  // update each player regarding gold remaining
-  if (strcmp(player_getName(triggerPlayer), player_getName(currPlayer)) != 0) {
-    // dont double-update player who picked up gold
-    sendGold(currPlayer, 0);
+  int collected = 0;                   // gold picked up along the way
+  int steps = 0;                       // tiles moved
+
+  // walk until blocked, or until the last gold is picked up
+  while (stepPlayer(game, player, dx, dy, &collected)) {
+    steps++;
+    player_updateVision(player, game_getGrid(game), game_getVisionCache(game));
+    if (collected > 0 && game_getRemainingGold(game) == 0) {
+      break;
+    }
   }
-  
-}
-/************** moveIterateHelper*********/
-/* helper to pass into hashtable_iterate in moveHelper
- * finds a player with a provided charID
- * stores the matching player back in the container of void pointers
- */
-static void
-moveIterateHelper(void* arg, const char* key, void* item)
-{
-  void** container = arg;
-  char* targetCharID = container[1];
-  player_t* currPlayer = item;
-
-  // matches player with target ID
-  char targetID = *targetCharID;
-  char currID = player_getCharID(currPlayer);
-  if (targetID == currID) {
-    container[0] = item;
+  if (steps == 0) {
+    return false;
   }
+  log_d("run move ended after %d steps", steps);
+  return finishMove(game, player, collected);
 }
 
-/************* repeatMovePlayerHelper **********/
-/* repeatedly moves a player by a given integer value
- * where the integer represents the distance moved in the in-game map
- * returns true if, at any point in the "big move", the last gold is collected
+/************** movePlayerHelper ********/
+/* moves a player by the given number of columns (dx) and rows (dy),
+ * each -1, 0 or 1, with stepPlayer, then tells everyone with finishMove
+ * returns true if player picks up gold and there is no gold remaining
  * false if otherwise
  */
 static bool
-repeatMovePlayerHelper(player_t* player, int directionValue)
+movePlayerHelper(game_t* game, player_t* player, int dx, int dy)
 {
-  bool gameOverFlag = false;           // set to true if last gold picked up
-  grid_t* grid = game_getGrid(game);   // in-game grid
-  // character player is trying to move to
-  char next = grid_getActive(grid)[player_getPos(player) + directionValue];
-  
-  // as long as we encounter a roomtile/passagetile/goldtile/player, move
-  while (next == ROOMTILE || next == PASSAGETILE || next == GOLDTILE 
-         || isupper(next) != 0) {
-    // move player and update next char
-    gameOverFlag = movePlayerHelper(player, directionValue);
-    // return early if game ends before move ends
-    if (gameOverFlag) {
-      return gameOverFlag;
-    }
-    next = grid_getActive(grid)[player_getPos(player) + directionValue];
+  int collected = 0;                   // gold picked up
+
+  if ( ! stepPlayer(game, player, dx, dy, &collected)) {
+    log_s("invalid move request from %s", player_getName(player));
+    // no need to update vision if the player never actually moved
+    return false;
   }
-  // returns false if game continues, true if it ends
-  return gameOverFlag;
+  return finishMove(game, player, collected);
 }
 
-/************** movePlayerHelper ********/
+/************** stepPlayer ********/
 /* handles the actual in-game process of moving players
- * takes the player to move, and an integer representing the distance
- * to shift the player's position in the in-game map
- * moves the player, picks up gold if necessary, and updates all vision
- * returns true if player picks up gold and there is no gold remaining
- * false if otherwise
+ * takes the player to move, and the number of columns (dx) and rows (dy)
+ * to shift the player's position in the in-game map, each -1, 0 or 1
+ * moves the player, swapping places with anyone standing there, and picks up
+ * gold if necessary, adding it to *collected; nobody is told, see finishMove
+ * returns true if the player moved, false if the way is blocked
  */
 static bool
-movePlayerHelper(player_t* player, int directionValue)
+stepPlayer(game_t* game, player_t* player, int dx, int dy, int* collected)
 {
   player_t* bumpedPlayer = NULL; // player that current "mover" "collides" with
   char bumpedPlayerCharID;       // that player's char representation on the map
-  hashtable_t* playerTable = game_getPlayers(game); // table of players
   grid_t* grid = game_getGrid(game); // in-game grid      
   int playerPos;                 // in game position of current player
   int bumpedPos;                 // position of bumped player, if they exist
-  bool gameOverFlag = false;     // becomes true if pickupGold returns true
 
+  // position client is trying to move to, -1 if off the map
+  int nextPos = grid_neighbor(grid, player_getPos(player), dx, dy);
   // grid tile that client is trying to move to 
-  char next = grid_getActive(grid)[player_getPos(player) + directionValue];
+  char next = nextPos >= 0 ? grid_getActive(grid)[nextPos] : ' ';
   log_c("in move, nextChar = %c", next);
   // char representation of moving player on map
   const char playerCharID = player_getCharID(player); 
   playerPos = player_getPos(player);
 
-  // if the move is valid (does not hit a wall or similar)
-  if (next == ROOMTILE || next == PASSAGETILE || next == GOLDTILE 
-      || isupper(next) != 0) {
-
-    // if we land on a pile of gold
-    if (next == GOLDTILE) {
-      log_v("nextchar is a goldtile");
-      // update map with removed gold pile and new player position
-      grid_revertTile(grid, player_getPos(player));
-      player_setPos(player, player_getPos(player) + directionValue);
-      grid_replace(grid, player_getPos(player), playerCharID);
-
-      // update player gold and the game's piles
-      gameOverFlag = pickupGold(player);
-
-    // if we hit another player, handle collision
-    } else if (isupper(next) != 0) {
-      log_v("handling a collision");
-      // holds two items to pass into iterator
-      void* voidPlayer = NULL;
-      void* container[2] = {voidPlayer, &next}; 
-      
-      // iterate over the hashtable to find the player bumped into
-      // assigns bumpedPlayer
-      hashtable_iterate(playerTable, container, moveIterateHelper);
-      bumpedPlayer = container[0];
-
-      // switch the positions of the colliding players
-      bumpedPos = player_getPos(bumpedPlayer);
-      player_setPos(player, bumpedPos);
-      player_setPos(bumpedPlayer, playerPos);
-      
-      // update map with the new positions of both players
-      bumpedPlayerCharID = player_getCharID(bumpedPlayer);
-      grid_replace(grid, player_getPos(bumpedPlayer), bumpedPlayerCharID);
-      grid_replace(grid, player_getPos(player), playerCharID);
-      
-    // if normal move, no gold or collision
-    } else {
-      log_v("making a normal move");
-      // revert player's old position to reference
-      grid_revertTile(grid, player_getPos(player));
-      
-      // then set their new position and update map accordingly
-      player_setPos(player, player_getPos(player) + directionValue);
-      grid_replace(grid, player_getPos(player), playerCharID);
+  // if we land on a pile of gold
+  if (next == GOLDTILE) {
+    log_v("nextchar is a goldtile");
+    // update map with removed gold pile and new player position
+    grid_revertTile(grid, player_getPos(player));
+    game_movePlayer(game, player, nextPos);
+    grid_replace(grid, player_getPos(player), playerCharID);
+
+    // update player gold and the game's piles
+    *collected += pickupGold(game, player);
+
+  // if we hit another player, handle collision
+  } else if (isupper(next) != 0) {
+    log_v("handling a collision");
+    // find the player bumped into
+    bumpedPlayer = game_getPlayerAt(game, nextPos);
+    if (bumpedPlayer == NULL) {
+      log_v("no player found where one was drawn, ignoring move");
+      return false;
     }
-  // if move is invalid log and do nothing
+
+    // switch the positions of the colliding players
+    bumpedPos = player_getPos(bumpedPlayer);
+    game_movePlayer(game, player, bumpedPos);
+    game_movePlayer(game, bumpedPlayer, playerPos);
+    
+    // update map with the new positions of both players
+    bumpedPlayerCharID = player_getCharID(bumpedPlayer);
+    grid_replace(grid, player_getPos(bumpedPlayer), bumpedPlayerCharID);
+    grid_replace(grid, player_getPos(player), playerCharID);
+    // players sharing a letter leave the map as it was, but both still moved
+    grid_markDirty(grid, bumpedPos);
+    grid_markDirty(grid, playerPos);
+    
+  // if normal move, no gold or collision
+  } else if (next == ROOMTILE || next == PASSAGETILE) {
+    log_v("making a normal move");
+    // revert player's old position to reference
+    grid_revertTile(grid, player_getPos(player));
+    
+    // then set their new position and update map accordingly
+    game_movePlayer(game, player, nextPos);
+    grid_replace(grid, player_getPos(player), playerCharID);
+
+  // if move is invalid do nothing
   } else {
-      log_s("invalid move request from %s", player_getName(player));
-      // no need to update vision if the player never actually moved
-      return gameOverFlag;
+    return false;
+  }
+  return true;
+}
+
+/************** finishMove ********/
+/* tells everyone about a move just made by the given player with stepPlayer,
+ * which picked up the given amount of gold: sends the mover one GOLD message
+ * for all of it, and everyone else the new amount left, then updates
+ * all client's vision once with showChanges
+ * returns true if the move picked up the last of the gold, so the game is over
+ */
+static bool
+finishMove(game_t* game, player_t* player, int collected)
+{
+  if (collected > 0) {
+    // notify player
+    sendGold(game, player, collected);
+
+    // notify all other players of new gold state using GOLD message w/ 0 picked up,
+    // except those who quit
+    player_t** roster = game_getRoster(game);
+    const addr_t* addrs = game_getRosterAddr(game);
+    for (int i = 0; i < game_getRosterSize(game); i++) {
+      if (roster[i] != player && message_isAddr(addrs[i])) {
+        sendGold(game, roster[i], 0);
+      }
+    }
   }
+
   // update all client's vision after a move
-  updatePlayersVision();
+  showChanges(game, player);
   // true if no more gold in the game, false if otherwise
-  return gameOverFlag;
+  return collected > 0 && game_getRemainingGold(game) == 0;
 }
 
 /**************** movePlayer *************/
@@ -782,81 +1431,75 @@ movePlayerHelper(player_t* player, int directionValue)
  * so that message_loop will stop looping and call gameOver()
  */ 
 static bool 
-movePlayer(player_t* player, char directionChar)
+movePlayer(game_t* game, player_t* player, char directionChar)
 {
   bool gameOverFlag = false;           // set to true if all gold collected
-  grid_t* grid = game_getGrid(game);   // game grid
   // calls appropriate function for given move char
+  // with the number of columns (dx) and rows (dy) to move by
   switch(directionChar) {
     // single move right case
     case 'l' :
-      gameOverFlag = movePlayerHelper(player, 1);
+      gameOverFlag = movePlayerHelper(game, player, 1, 0);
       break;
     // single move left case
     case 'h' :
-      gameOverFlag = movePlayerHelper(player, -1);
+      gameOverFlag = movePlayerHelper(game, player, -1, 0);
       break;
     // single move up case 
     case 'k' :
-      // make move negative, and subtract 1 to account for newline
-      gameOverFlag = movePlayerHelper(player, 0 - grid_getNumColumns(grid) - 1);
+      gameOverFlag = movePlayerHelper(game, player, 0, -1);
       break;
     // single move down case
     case 'j' :
-      // add 1 to account for newline
-      gameOverFlag = movePlayerHelper(player, grid_getNumColumns(grid) + 1);
+      gameOverFlag = movePlayerHelper(game, player, 0, 1);
       break;
     // single move down left case
     case 'b' :
-      // ncolumns is 1 less than the move needed for pure down
-      gameOverFlag = movePlayerHelper(player, grid_getNumColumns(grid));
+      gameOverFlag = movePlayerHelper(game, player, -1, 1);
       break;
     // single move down right case
     case 'n' :
-      // add 2 to ncolumns, 1 to get pure down then 1 to go right
-      gameOverFlag = movePlayerHelper(player, grid_getNumColumns(grid) + 2);
+      gameOverFlag = movePlayerHelper(game, player, 1, 1);
       break;
     // single move up left case
     case 'y' :
-      // make negative, then subtract 1 for pure up then 1 to go left
-      gameOverFlag = movePlayerHelper(player, 0 - grid_getNumColumns(grid) - 2);
+      gameOverFlag = movePlayerHelper(game, player, -1, -1);
       break;
     // single move up right case
     case 'u' :
-      // make negative to move up, ncolumns is 1 less than a pure up
-      gameOverFlag = movePlayerHelper(player, 0 - grid_getNumColumns(grid));
+      gameOverFlag = movePlayerHelper(game, player, 1, -1);
       break;
     // repeat move right case
     case 'L' :
-      gameOverFlag = repeatMovePlayerHelper(player, 1);
+      gameOverFlag = repeatMovePlayerHelper(game, player, 1, 0);
       break;
     // repeat move left case
     case 'H' :
-      gameOverFlag = repeatMovePlayerHelper(player, -1);
+      gameOverFlag = repeatMovePlayerHelper(game, player, -1, 0);
       break;
-    // repeat move up case 
+    // repeat move up case
     case 'K' :
-      gameOverFlag = repeatMovePlayerHelper(player, 0 - grid_getNumColumns(grid) - 1);
+      gameOverFlag = repeatMovePlayerHelper(game, player, 0, -1);
       break;
     // repeat move down case
     case 'J' :
-      gameOverFlag = repeatMovePlayerHelper(player, grid_getNumColumns(grid) + 1);
+      gameOverFlag = repeatMovePlayerHelper(game, player, 0, 1);
       break;
     // repeat move down left case
     case 'B' :
-      gameOverFlag = repeatMovePlayerHelper(player, grid_getNumColumns(grid));
+      gameOverFlag = repeatMovePlayerHelper(game, player, -1, 1);
       break;
     // repeat move down right case
     case 'N' :
-      gameOverFlag = repeatMovePlayerHelper(player, grid_getNumColumns(grid) + 2);
+      gameOverFlag = repeatMovePlayerHelper(game, player, 1, 1);
       break;
     // repeat move up left case
     case 'Y' :
-      gameOverFlag = repeatMovePlayerHelper(player, 0 - grid_getNumColumns(grid) - 2);
+      gameOverFlag = repeatMovePlayerHelper(game, player, -1, -1);
       break;
     // repeat move up right case
     case 'U' :
-      gameOverFlag = repeatMovePlayerHelper(player, 0 - grid_getNumColumns(grid));
+      gameOverFlag = repeatMovePlayerHelper(game, player, 1, -1);
       break;
     // default to log and ignore
     default:
@@ -867,56 +1510,226 @@ movePlayer(player_t* player, char directionChar)
   return gameOverFlag;
 }
 
+/****************** showChanges ******************/
+/* shows players the changes to the game's map made by the given player,
+ * who may be NULL if they just left it
+ * without ticks, updates everyone's vision at once with updatePlayersVision;
+ * in tick mode that waits for the next tick, and only the mover's own vision
+ * is brought up to date now, so they still remember every tile they passed
+ */
+static void showChanges(game_t* game, player_t* mover)
+{
+  if (tickRate == 0) {
+    updatePlayersVision(game);
+  } else if (mover != NULL) {
+    player_updateVision(mover, game_getGrid(game), game_getVisionCache(game));
+  }
+}
+
 /****************** updateHelper ******************/
 /* helper function for updatePlayersVision
- * passed into hashtable_iterate
- * does all the work of updating vision and sending display messages
+ * passed into workpool_run, with the visionRound_t being run as arg
+ * updates the vision of the player in round->jobs[index] 
+ * and points the job at their DISPLAY message, but does not send it
+ * (the message sits in front of the grid's active map, see grid_getDisplay),
+ * or for a client sent deltas, at the one encoded in their delta state
+ * players who did not move and cannot see any changed tile are skipped
+ * runs at the same time as other players' updates, 
+ * so only touches this player's own state and never logs
  */
-static void updateHelper(void* arg, const char* key, void* item)
+static void updateHelper(void* arg, int index)
 {
-  player_t* currPlayer = item;         // current player struct in hashtable
+  visionRound_t* round = arg;          // the update this job is part of
+  game_t* game = round->game;          // game being updated
+  const uint64_t* dirty = round->dirty; // tiles changed since the last update
+  visionJob_t* job = &round->jobs[index]; // this player's job
+  player_t* currPlayer = job->player;  // player being updated
+  grid_t* gameGrid = game_getGrid(game); // server's grid
   grid_t* playerVisionGrid;            // current player's vision
   int playerPos;                       // current player's position
   
+  job->send = false;
+
   // handle spectator differently
-  if (strcmp(player_getName(currPlayer), "spectator") == 0) {
-    log_v("updating spectator vision");
-    // send them the active map, don't bother changing their vision
-    sendDisplay(currPlayer, grid_getActive(game_getGrid(game)));
+  if (game_getRosterRole(game)[job->slot] == ROLE_SPECTATOR) {
+    // spectator sees the whole map, so any change at all is worth sending
+    if (bitset_next(dirty, grid_getVisionWords(gameGrid), 0) >= 0) {
+      // send them the active map, don't bother changing their vision
+      job->frame = encodeDisplay(currPlayer, gameGrid);
+      job->send = job->frame != NULL;
+    }
     return;
   }
 
   // handle normal players
-  log_s("updating %s's vision", player_getName(currPlayer));
   playerVisionGrid = player_getVision(currPlayer);
   playerPos = player_getPos(currPlayer);
 
-  // calculate and update a player's vision grid
-  player_updateVision(currPlayer, game_getGrid(game));
+  // recompute the vision of players who moved, patch in changes others can see
+  if ( ! player_refreshVision(currPlayer, gameGrid, dirty, 
+                              game_getVisionCache(game))) {
+    return;
+  }
   // replace the character at the player's position with the '@' symbol
   // in the player's local vision string
   grid_replace(playerVisionGrid, playerPos, PLAYERCHAR);
 
-  // message player with updated vision
-  sendDisplay(currPlayer, grid_getActive(player_getVision(currPlayer)));
+  // build message with updated vision, unless a delta client has it already
+  job->frame = encodeDisplay(currPlayer, playerVisionGrid);
+  job->send = job->frame != NULL;
+}
+
+/****************** addVisionJob ******************/
+/* helper function for updatePlayersVision
+ * appends a job for the given player to visionJobs, growing it as needed
+ */
+static void addVisionJob(player_t* player)
+{
+  visionJob_t* job;                    // job being filled in
+
+  // make room for another job
+  if (numVisionJobs == maxVisionJobs) {
+    int newMax = maxVisionJobs > 0 ? 2 * maxVisionJobs : maxPlayers + 1;
+    visionJobs = mem_assert(realloc(visionJobs, newMax * sizeof(visionJob_t)),
+                            "failed to grow vision jobs\n");
+    maxVisionJobs = newMax;
+  }
+
+  job = &visionJobs[numVisionJobs++];
+  job->player = player;
+  job->slot = player_getSlot(player);
+  job->frame = NULL;
+  job->send = false;
+}
+
+/****************** addNearbyVisionJobs ******************/
+/* helper function for updatePlayersVision
+ * adds a job for each player standing in sight of a changed tile,
+ * looked up in the grid's visibility table, and one for the spectator
+ * raycast vision is symmetric, so they are the only players who can see a change,
+ * and everyone who moved is among them, as they stand on changed tiles
+ * the jobs end up in roster order, with one per player
+ * returns false, adding no jobs, if a job per player would be as cheap,
+ * with more tiles in sight of the changes than players times vision words,
+ * or if the shortcut doesn't hold: without a table, or with shadowcast vision
+ */
+static bool addNearbyVisionJobs(game_t* game, const uint64_t* dirty)
+{
+  grid_t* gameGrid = game_getGrid(game); // server's grid
+  size_t words = grid_getVisionWords(gameGrid); // length of the dirty bitset
+  long budget = (long)game_getRosterSize(game) * words; // cost of a job per player
+  long inSight = 0;                    // tiles in sight of the changes
+  const int* runs;                     // visible runs from a changed tile
+  int numRuns;                         // number of those runs
+  player_t* player;                    // player in sight of a change
+
+  if (grid_getVisionMode(gameGrid) != VISION_RAYCAST) {
+    return false;
+  }
+  // count the tiles to look at first, and give up if there are too many
+  for (int pos = bitset_next(dirty, words, 0); pos >= 0; 
+       pos = bitset_next(dirty, words, pos + 1)) {
+    if ((numRuns = grid_lookupVisibility(gameGrid, pos, &runs)) == 0) {
+      return false;
+    }
+    for (int r = 0; r < numRuns; r++) {
+      inSight += runs[2 * r + 1];
+    }
+    if (inSight > budget) {
+      return false;
+    }
+  }
+
+  // then add everyone standing on them, perhaps more than once
+  if ((player = game_getSpectator(game)) != NULL) {
+    addVisionJob(player);
+  }
+  for (int pos = bitset_next(dirty, words, 0); pos >= 0; 
+       pos = bitset_next(dirty, words, pos + 1)) {
+    numRuns = grid_lookupVisibility(gameGrid, pos, &runs);
+    for (int r = 0; r < numRuns; r++) {
+      for (int seen = runs[2 * r]; seen < runs[2 * r] + runs[2 * r + 1]; seen++) {
+        if ((player = game_getPlayerAt(game, seen)) != NULL) {
+          addVisionJob(player);
+        }
+      }
+    }
+  }
+
+  // sort the jobs into roster order and drop repeats
+  qsort(visionJobs, numVisionJobs, sizeof(visionJob_t), compareVisionJobs);
+  int kept = 0;                        // jobs kept so far
+  for (int i = 0; i < numVisionJobs; i++) {
+    if (kept == 0 || visionJobs[kept - 1].slot != visionJobs[i].slot) {
+      visionJobs[kept++] = visionJobs[i];
+    }
+  }
+  numVisionJobs = kept;
+  return true;
+}
+
+/****************** compareVisionJobs ******************/
+/* qsort comparator putting vision jobs in roster order */
+static int compareVisionJobs(const void* a, const void* b)
+{
+  int x = ((const visionJob_t*)a)->slot;
+  int y = ((const visionJob_t*)b)->slot;
+  return (x > y) - (x < y);
+}
+
+/****************** deleteVisionJobs ******************/
+/* frees the vision jobs and the thread pool used by updatePlayersVision */
+static void deleteVisionJobs()
+{
+  free(visionJobs);
+  visionJobs = NULL;
+  numVisionJobs = maxVisionJobs = 0;
+  workpool_delete(visionPool);
+  visionPool = NULL;
 }
 
 /******************* updatePlayersVision *************/
-/* updates vision for all players currently in the game
+/* updates vision for all players affected by changes to the map
+ * since the last call, then forgets those changes
+ * only players who moved have their field of view recomputed;
+ * the rest are only updated if a changed tile is in their view (see updateHelper)
+ * in a large game, only players in sight of a change are even looked at
+ * (see addNearbyVisionJobs), so a move costs the same however many have joined
  * handles spectator seperately as vision functions don't work on them
- * then sends the DISPLAY message with appropriate vision string
+ * players are updated in parallel across visionPool,
+ * then the DISPLAY messages are sent in roster order once every update is done
  * takes no parameters and returns void
  */
-static void updatePlayersVision()
+static void updatePlayersVision(game_t* game)
 {
-  hashtable_t* playerTable;            // table of players in game
-
-  // assign and check playerTable
-  playerTable = mem_assert(game_getPlayers(game), 
-                           "players NULL in updateVision"); 
-
-  // iterate over all players and update their vision
-  hashtable_iterate(playerTable, NULL, updateHelper);
+  grid_t* gameGrid = game_getGrid(game); // server's grid
+  player_t** roster = game_getRoster(game); // players in the order they joined
+  const addr_t* addrs = game_getRosterAddr(game); // where each player is
+  const uint64_t* dirty = grid_getDirty(gameGrid); // tiles changed since last time
+
+  // one job per player who might see a change, or else per player still
+  // connected (players who quit have no address), in roster order,
+  // then update all of them at once
+  numVisionJobs = 0;
+  if ( ! addNearbyVisionJobs(game, dirty)) {
+    for (int i = 0; i < game_getRosterSize(game); i++) {
+      if (message_isAddr(addrs[i])) {
+        addVisionJob(roster[i]);
+      }
+    }
+  }
+  visionRound_t round = { game, dirty, visionJobs };
+  workpool_run(visionPool, updateHelper, &round, numVisionJobs);
+  grid_clearDirty(gameGrid);
+
+  // sending stays on this thread, in the same order as before
+  for (int i = 0; i < numVisionJobs; i++) {
+    visionJob_t* job = &visionJobs[i];
+    if (job->send && message_isAddr(addrs[job->slot])) {
+      log_s("updated %s's vision", player_getName(job->player));
+      message_send(addrs[job->slot], job->frame);
+    }
+  }
 }
 
 /************** MESSAGING FUNCTIONS ***************/
@@ -931,13 +1744,17 @@ static void updatePlayersVision()
 /**************** handleMessage ***************/
 /* helper for message_loop, handles when server recieves a message
  * and then calls appropriate functions
+ * each message goes to the game its sender is in, found by address, 
+ * and a new client is sent to the game picked by openGame
+ * a game ends when its last gold is collected or on a critical error in it
  * returns false when loop should continue (non-critical errors) or normal behavior
- * returns true when loop should end (critical errors or last gold collected)
+ * returns true when loop should end: when a game ends, unless hosting several
  */
 static bool handleMessage(void* arg, const addr_t from, const char* message)
 {
   //char key;                            // key input from key message
   bool gameOverFlag = false;           // true if all gold collected
+  game_t* game;                        // game the message is for
 
   // if invalid message (bad address or null string) log and continue looping
   if ( ! message_isAddr(from) || message == NULL) {
@@ -947,6 +1764,15 @@ static bool handleMessage(void* arg, const addr_t from, const char* message)
 
   log_s("received message: %s", message);
 
+  // clients already playing or watching stay in their game
+  if ((game = findGame(from)) == NULL && (strncmp("PLAY ", message, 5) == 0
+                                          || strncmp("SPECTATE", message, 8) == 0)
+      && (game = openGame()) == NULL) {
+    log_v("no game to add client to");
+    message_send(from, "QUIT no game could be started for you");
+    return false;
+  }
+
   if (strncmp("PLAY ", message, 5) == 0) { 
     
     // workaround for param being const but needs to be modified
@@ -958,28 +1784,45 @@ static bool handleMessage(void* arg, const addr_t from, const char* message)
     char* content = messageCopy + strlen("PLAY ");
 
     // returns false on failure to create player
-    if ( ! handlePlayerConnect(content, from)) {
+    if ( ! handlePlayerConnect(game, content, from)) {
       message_send(from, "ERROR failed to add you to game\n");
       free(messageCopy);
-      // stop looping as critical error has occurred
-      return true;
+      // end the game as critical error has occurred
+      return endGame(game, false);
     }
     // clean up memory
     free(messageCopy);
   } 
   else if (strncmp("SPECTATE", message, 8) == 0) {
-    if ( ! handleSpectator(from)) { 
+    if ( ! handleSpectator(game, from)) { 
       message_send(from, "ERROR could not add you to game\n");
     }  
   }
   else if (strncmp("KEY ", message, 4) == 0) {
     // send just key to helper func
     const char key = message[4];
+    if (game == NULL) {
+      log_v("key from an address in no game");
+      return false;
+    }
     // set to true if gold picked up and remaining is 0
-    gameOverFlag = handleKey(key, from);
+    if (handleKey(game, key, from)) {
+      gameOverFlag = endGame(game, true);
+    }
     return gameOverFlag;
+  }
+  else if (strcmp("DELTA", message) == 0 || strncmp("ACK ", message, 4) == 0) {
+    if (game == NULL) {
+      log_v("DELTA or ACK from an address in no game");
+      return false;
+    }
+    if (message[0] == 'D') {
+      handleDelta(game, from);
+    } else {
+      handleAck(game, message + 4, from);
+    }
   } else {
-    message_send(from, "ERROR message not PLAY SPECTATE or KEY\n");
+    message_send(from, "ERROR message not PLAY SPECTATE KEY DELTA or ACK\n");
     log_s("invalid message received: %s", message);
   }
   // return true if game over or critical error to end loop
@@ -989,20 +1832,16 @@ static bool handleMessage(void* arg, const addr_t from, const char* message)
 
 /************* handleKey *******************/
 /* handles key input from the client
- * and calls the appropriate function according to their input
+ * finds the player who sent it and has applyKey apply it, or in tick mode,
+ * queues a player's key for the next tick (see runTick);
+ * the spectator's keys change nothing in the game, so are never queued
  * returns true if the message_loop should stop looping
  * which happens when the game ends or encounters a critical error
  * and false if it should continue
  */
-static bool handleKey(const char key, addr_t from)
+static bool handleKey(game_t* game, const char key, addr_t from)
 {
   player_t* player;                    // player that input is coming from
-  bool validKey = false;               // flags if given key is valid input
-  bool gameOverFlag = false;           // true if all gold picked up
-  // array of all valid inputs from players
-  const char playerKeys[17] = {'Q', 'h', 'H', 'l', 'L', 'j', 'J', 'k', 'K', 'y',
-                               'Y', 'u', 'U', 'b', 'B', 'n', 'N'};    
-  const char quitKey = 'Q';            // only valid input from spectators
   
   // assign player to corresponding address
   if ((player = game_getPlayerAtAddr(game, from)) == NULL) {
@@ -1017,8 +1856,41 @@ static bool handleKey(const char key, addr_t from)
     return false;
   }
 
+  // in tick mode, players' keys wait for the next tick
+  if (tickRate > 0 && player != game_getSpectator(game)) {
+    if ( ! game_queueKey(game, player, key)) {
+      log_s("dropping key from %s, who has too many waiting", player_getName(player));
+    }
+    return false;
+  }
+  return applyKey(game, player, key);
+}
+
+/************* applyKey *******************/
+/* applies a key from the given player or spectator
+ * and calls the appropriate function according to their input
+ * keys from a player who has since quit are ignored
+ * returns true if the last gold was collected, so the game is over,
+ * and false if it should continue
+ */
+static bool applyKey(game_t* game, player_t* player, const char key)
+{
+  addr_t from = player_getAddr(player); // where the player is
+  bool validKey = false;               // flags if given key is valid input
+  bool gameOverFlag = false;           // true if all gold picked up
+  // array of all valid inputs from players
+  const char playerKeys[17] = {'Q', 'h', 'H', 'l', 'L', 'j', 'J', 'k', 'K', 'y',
+                               'Y', 'u', 'U', 'b', 'B', 'n', 'N'};    
+  const char quitKey = 'Q';            // only valid input from spectators
+
+  // a key queued before its player quit
+  if ( ! message_isAddr(from)) {
+    log_s("ignoring key from %s, who has quit", player_getName(player));
+    return false;
+  }
+
   // validate key from spectator and handle accordingly
-  if (strcmp(player_getName(player), "spectator") == 0) {
+  if (player == game_getSpectator(game)) {
     log_v("player is spectator, only allowing 'Q' key");
     if (key == quitKey) {
       message_send(from, "QUIT Thanks for watching!\n");
@@ -1044,11 +1916,11 @@ static bool handleKey(const char key, addr_t from)
     // quit if appropriate
     if (key == quitKey) {
       // send message, remove chaar from map, and continue looping
-      handlePlayerQuit(player);
+      handlePlayerQuit(game, player);
       return gameOverFlag;
     } else {
       // all keys except 'Q' are movement keys
-      gameOverFlag = movePlayer(player, key);
+      gameOverFlag = movePlayer(game, player, key);
       // will be true if player moved and collected last pile of gold
       return gameOverFlag;
     }
@@ -1064,22 +1936,16 @@ static bool handleKey(const char key, addr_t from)
  * it is abstracted here to prevent having to reference "game" each time
  * format: GRID nrows ncolumns
  */
-static void sendGrid(addr_t to)
+static void sendGrid(game_t* game, addr_t to)
 {
-  char* message;                       // message to send to clients
-  grid_t* grid;                        // game grid
+  grid_t* grid = game_getGrid(game);   // game grid
   
   // do nothing if invalid param
   if ( ! message_isAddr(to)) {
     return;
   }
-  grid = game_getGrid(game);
-  // build message. allocs 2 ints, plus space for "GRID  \0"
-  message = malloc((2 * sizeof(int)) + 7);
-  sprintf(message, "GRID %d %d", grid_getNumRows(grid), grid_getNumColumns(grid));
-  // send message
-  message_send(to, message);
-  free(message);
+  // build the message in place and send it
+  message_sendf(to, "GRID %d %d", grid_getNumRows(grid), grid_getNumColumns(grid));
 }
 
 /************** sendGold **************/
@@ -1092,9 +1958,8 @@ static void sendGrid(addr_t to)
  * r is the number of nuggets remaining in game
  * returns nothing on success or failure, but it exits early on failure
  */
-static void sendGold(player_t* player, int goldCollected)
+static void sendGold(game_t* game, player_t* player, int goldCollected)
 {
-  char* message;                       // message to send to client
   int playerPurse;                     // amount of gold held by player
   int remainingGold;                   // amount of gold left "on the floor"
 
@@ -1106,12 +1971,9 @@ static void sendGold(player_t* player, int goldCollected)
   playerPurse = player_getGold(player);
   remainingGold = game_getRemainingGold(game);
 
-  // allocate space for 3 ints and "GOLD   \0"
-  message = malloc((sizeof(int) * 3) + 8);
-  // build message and send, then clean up
-  sprintf(message, "GOLD %d %d %d", goldCollected, playerPurse, remainingGold);
-  message_send(player_getAddr(player), message);
-  free(message);
+  // build message in place and send
+  message_sendf(player_getAddr(player), "GOLD %d %d %d", 
+                goldCollected, playerPurse, remainingGold);
 }
 
 /************* sendOk *************/
@@ -1121,32 +1983,27 @@ static void sendGold(player_t* player, int goldCollected)
  */
 static void sendOK(player_t* player)
 {
-  char* message;                       // message to send to client
   // do nothing if invalid param
   if (player == NULL) {
     return;
   }
 
-  // build message. Large enough for a character and "OK \0"
-  message = malloc(sizeof(char) * 5);
-  sprintf(message, "OK %c", player_getCharID(player));
-  message_send(player_getAddr(player), message);
-  free(message);
+  // build message in place and send
+  message_sendf(player_getAddr(player), "OK %c", player_getCharID(player));
 }
 
 /************* sendDisplay ****************/
-/* this function sends the client the string it is supposed to render
- * it takes a player and a string as parameters
+/* this function sends the client the map it is supposed to render
+ * it takes a player and the grid whose active map they see as parameters
+ * the DISPLAY message is already in place in front of the map (see grid_getDisplay)
  * returns early on error
  */
-static void sendDisplay(player_t* player, char* displayString) {
+static void sendDisplay(player_t* player, grid_t* grid) {
   
   addr_t to;                           // address to send message to
-  char* initial = "DISPLAY\n";         // beginning of display messages
-  char* message = NULL;                // final message sent to clients
   
   // check params
-  if (player == NULL || displayString == NULL) {
+  if (player == NULL || grid == NULL) {
     return;
   }
   // get and check address
@@ -1155,12 +2012,78 @@ static void sendDisplay(player_t* player, char* displayString) {
     return;
   }
 
-  // build string
-  message = mem_malloc_assert(strlen(initial) + strlen(displayString) + 1, 
-                              "failed to alloc message in sendDisplay\n");
-  strcpy(message, initial);
-  strcat(message, displayString);
-  // send message and clean up
-  message_send(to, message);
-  free(message);
+  const char* frame = encodeDisplay(player, grid);
+  if (frame != NULL) {
+    message_send(to, frame);
+  }
+}
+
+/************* encodeDisplay ****************/
+/* returns the message carrying the given grid's active map to the player:
+ * the DISPLAY message in front of it, or for a client that asked for deltas,
+ * a DELTA or KEYFRAME message from their delta state (see delta_encode),
+ * which is NULL if they already have the map
+ * touches only the player's own state, so may run on any thread
+ */
+static const char* encodeDisplay(player_t* player, grid_t* grid)
+{
+  deltastate_t* delta = player_getDelta(player); // frames the client holds
+
+  if (delta == NULL) {
+    return grid_getDisplay(grid);
+  }
+  return delta_encode(delta, grid_getActive(grid), grid_getMapLen(grid));
+}
+
+/************* handleDelta ****************/
+/* handles a DELTA message, by which a player or spectator asks to be sent
+ * their map as the changes since a frame they acknowledged (see delta.h),
+ * or asks again for a keyframe because they have lost track of their frames
+ * sends them a keyframe of what they see right away
+ */
+static void handleDelta(game_t* game, addr_t from)
+{
+  player_t* player;                    // player asking for deltas
+  grid_t* gameGrid = game_getGrid(game); // server's grid
+  grid_t* grid;                        // grid whose map the player sees
+  deltastate_t* delta;                 // frames sent to the player
+
+  if ((player = game_getPlayerAtAddr(game, from)) == NULL) {
+    log_v("failed to get player from addr passed to handleDelta");
+    return;
+  }
+  grid = player == game_getSpectator(game) ? gameGrid : player_getVision(player);
+
+  // malloc'd rather than from the game's arena, so that the state of a client
+  // who leaves, such as a replaced spectator, is freed right away
+  if ((delta = player_getDelta(player)) == NULL) {
+    delta = delta_new(grid_getNumRows(gameGrid), grid_getNumColumns(gameGrid),
+                      NULL);
+    if (delta == NULL) {
+      log_v("could not allocate delta state");
+      message_send(from, "ERROR could not send you deltas");
+      return;
+    }
+    player_setDelta(player, delta);
+  }
+  delta_reset(delta);
+  log_s("sending %s a keyframe", player_getName(player));
+  sendDisplay(player, grid);
+}
+
+/************* handleAck ****************/
+/* handles an ACK message, by which a client sent deltas says which frame
+ * it now holds, so later frames may be encoded against it
+ * acknowledgements that are stale, or from clients not sent deltas, are ignored
+ */
+static void handleAck(game_t* game, const char* seqString, addr_t from)
+{
+  player_t* player;                    // player acknowledging a frame
+  int seq;                             // frame acknowledged
+
+  if ((player = game_getPlayerAtAddr(game, from)) == NULL
+      || ! strToInt(seqString, &seq)
+      || ! delta_ack(player_getDelta(player), seq)) {
+    log_s("ignoring acknowledgement %s", seqString);
+  }
 }
@@ -13,9 +13,11 @@
  * David Kotz - May 2019
  */
 
+#define _DEFAULT_SOURCE                // SO_REUSEPORT
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdbool.h>
+#include <stdarg.h>
 #include <unistd.h>
 #include <errno.h>
 #include <string.h>
@@ -23,6 +25,7 @@
 #include <netdb.h>
 #include <arpa/inet.h>
 #include <sys/select.h>
+#include <sys/socket.h>
 #include <math.h>
 #include "message.h"
 #include "log.h"
@@ -45,22 +48,56 @@ static const int MaxPort = 65535;
  * One disadvantage to this approach is that all users of this module
  * must work with the same socket, and thus the same port number,
  * but a more flexible approach would require a much more complex interface.
+ * Each thread has its own socket, so a program may run one message_loop
+ * per thread; threads that never call message_init have none.
  */
-static int ourSocket = 0;     // socket on which to receive messages
+static _Thread_local int ourSocket = 0; // socket on which to receive messages
+
+/**************** file-local functions ****************/
+static int openSocket(const int port, const bool shared);
 
 /***********************************************************************/
 /**************** message_init ****************/
 /* 
  * Set up a socket on which to receive messages; return the port number.
- * Invariant: ourSocket = 0 if we return with error, else ourSocket > 0.
- * Log error and return zero if any error.
  * See message.h for detailed description.
  */
 int
 message_init(FILE* logFP)
 {
   log_init(logFP);
+  return openSocket(0, false);
+}
 
+/**************** message_initShared ****************/
+/* 
+ * Set up a socket that shares its port with other threads' sockets.
+ * See message.h for detailed description.
+ */
+int
+message_initShared(FILE* fp, const int port)
+{
+  // threads sharing a port usually share a log too, which is set up once
+  if (logFP != fp) {
+    log_init(fp);
+  }
+  if (port != 0 && (port < MinPort || port > MaxPort)) {
+    log_d("message_initShared: bad port number %d", port);
+    return 0;
+  }
+  return openSocket(port, true);
+}
+
+/**************** openSocket ****************/
+/* 
+ * Open this thread's socket and bind it to the given port, or to any
+ * free port if port is 0; if shared, let other sockets bind that port too.
+ * Invariant: ourSocket = 0 if we return with error, else ourSocket > 0.
+ * Log error and return zero if any error, else return the port number.
+ */
+static int
+openSocket(const int port, const bool shared)
+{
   // Have we already been initialized?
   if (ourSocket != 0) {
     log_v("message_init: called again, when already initialized");
@@ -75,11 +112,20 @@ message_init(FILE* logFP)
     return 0;
   }
 
+  // Let the kernel spread senders across every socket on the port
+  int on = 1;
+  if (shared && setsockopt(ourSocket, SOL_SOCKET, SO_REUSEPORT, &on, sizeof(on))) {
+    log_e("message_init: setting SO_REUSEPORT");
+    close(ourSocket);
+    ourSocket = 0;
+    return 0;
+  }
+
   // Name socket using wildcards
   struct sockaddr_in self;  // our address
   self.sin_family = AF_INET;
   self.sin_addr.s_addr = INADDR_ANY;
-  self.sin_port = 0;
+  self.sin_port = htons(port);
   if (bind(ourSocket, (struct sockaddr *) &self, sizeof(self))) {
     log_e("message_init: binding socket name");
     close(ourSocket);
@@ -96,10 +142,10 @@ message_init(FILE* logFP)
     return 0;
   }
   // extract our port number
-  int port = ntohs(self.sin_port);
-  log_d("message_init: ready at port '%d'", port);
+  int ourPort = ntohs(self.sin_port);
+  log_d("message_init: ready at port '%d'", ourPort);
 
-  return port;
+  return ourPort;
 }
 
 /**************** message_noAddr ****************/
@@ -199,7 +245,7 @@ message_stringAddr(const addr_t addr)
 {
   // Maximum string length to hold an IP address and port, plus null.
   // e.g., 255.255.255.255:65507
-  static char addrString[22]; // constant appears in snprintf below
+  static _Thread_local char addrString[22]; // constant appears in snprintf below
 
   snprintf(addrString, 22, "%s:%05d",
 	   inet_ntoa(addr.sin_addr), ntohs(addr.sin_port));
@@ -263,6 +309,32 @@ message_send(const addr_t to, const char* message)
   }
 }
 
+/**************** message_sendf ****************/
+/* 
+ * Format a message into this thread's buffer and send it.
+ * See message.h for detailed description.
+ */
+void
+message_sendf(const addr_t to, const char* format, ...)
+{
+  // room for the largest message, and its terminating null
+  static _Thread_local char buf[65507 + 1];
+  va_list args;
+
+  if (format == NULL) {
+    log_v("message_sendf: called with null format");
+    return; // error in usage of this function.
+  }
+  va_start(args, format);
+  int len = vsnprintf(buf, sizeof(buf), format, args);
+  va_end(args);
+  if (len < 0 || len > message_MaxBytes) {
+    log_v("message_sendf: message too long to send");
+    return;
+  }
+  message_send(to, buf);
+}
+
 /**************** message_loop ****************/
 /* 
  * Loop forever, calling handler functions for stdin or socket,
@@ -303,7 +375,7 @@ message_loop(void* arg, const float timeout,
   struct timeval  timeoutval;     // timeval equivalent of parameter 'timeout'
   if (timeout > 0.0) {
     timeoutval.tv_sec  = (int)timeout;
-    timeoutval.tv_usec = timeout - (int)timeout;
+    timeoutval.tv_usec = (timeout - (int)timeout) * 1000000;
   }
 
   // loop until error or some handler indicates time to quit looping
@@ -60,10 +60,34 @@ static const int message_MaxBytes = 65507;
  *   port number where messages can be sent; zero on error.
  * Caller expectations:
  *   call message_done() later when all messaging operations complete.
+ * Notes:
+ *   The socket belongs to the calling thread: message_send, message_loop
+ *   and message_done use the socket of the thread that calls them,
+ *   so each thread that calls message_init may run its own message_loop.
  * Logs: information about errors; the port number.
  */
 int message_init(FILE* logFP);
 
+/******************************************/
+/* message_initShared: initialize the module, on a port other threads may share.
+ * Caller provides:
+ *   file pointer(fp), passed through to log_init().  May be NULL.
+ *   port number to listen on, or 0 for any free port.
+ * Function returns:
+ *   port number where messages can be sent; zero on error.
+ * Caller expectations:
+ *   as for message_init.
+ * Notes:
+ *   Like message_init, but the socket is opened with SO_REUSEPORT, so other
+ *   threads can open theirs on the same port by passing the port returned 
+ *   by the first. The kernel then delivers each message to one of them,
+ *   picked by a hash of the sender's address, so all messages from one
+ *   sender reach the same thread, as long as the set of sockets is unchanged.
+ *   The log is only set up again if fp differs from the last.
+ * Logs: information about errors; the port number.
+ */
+int message_initShared(FILE* logFP, const int port);
+
 /******************************************/
 /* message_noAddr: return an addr_t representing "no address".
  * Logs: nothing.
@@ -115,6 +139,7 @@ bool message_setAddr(const char* hostname, const char* portStr, addr_t* addr);
  * Returns:
  *   a string representation of the address,
  *   which is a pointer to static storage that cannot be retained!
+ *   (each thread has its own, overwritten by its next call)
  * Logs:
  *   nothing.
  */
@@ -133,6 +158,23 @@ const char* message_stringAddr(const addr_t addr);
  */
 void message_send(const addr_t to, const char* message);
 
+/******************************************/
+/* message_sendf: format a message, as printf does, and send it.
+ * Caller provides:
+ *   a valid address to which to send the message,
+ *   a printf-style format string, followed by its arguments.
+ * Function returns: none
+ * Assumptions: message_init() has already been called.
+ * Notes:
+ *   The message is formatted into a buffer belonging to the calling thread,
+ *   so nothing is allocated. A message longer than message_MaxBytes is 
+ *   not sent.
+ * Logs:
+ *   errors in arguments, messages that are too long,
+ *   errors in sending the message.
+ */
+void message_sendf(const addr_t to, const char* format, ...);
+
 /******************************************/
 /* message_loop: loop, handling input and incoming messages.
  * Caller provides:
@@ -167,7 +209,7 @@ bool message_loop(void* arg, const float timeout,
                                         const char* message));
 
 /******************************************/
-/* message_done: shut down the module.
+/* message_done: shut down the module, closing the calling thread's socket.
  * Caller provides: nothing.
  * Function returns: nothing.
  * Assumptions: 